@@ -0,0 +1,200 @@
+// channel_latency.c - Control-channel messages: memfd ring vs UNIX socket
+//
+// A producer process sends BENCH_MESSAGES messages, one every BENCH_GAP_US,
+// to a consumer process: first through the ring from nsrun_channel.h (set
+// up the way nsrun does it, and opened through NSRUN_CHANNEL_FD), then as
+// the same struct over a SOCK_SEQPACKET socketpair. For each transport it
+// reports what a send costs the workload and the latency from send to the
+// consumer holding the message.
+//
+// The ring is read twice: by a consumer that busy-polls, and by one that
+// polls like the supervisor (no sleeping while messages flow, then a backoff
+// from 50 us to 1 ms, as in src/control.c). The socket consumer blocks in
+// recv. On a single CPU a spinning consumer competes with the producer,
+// which shows in its tail.
+
+#include "nsrun_channel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_CAPACITY 1024
+#define POLL_MIN_US 50
+#define POLL_MAX_US 1000
+
+typedef enum Transport { TRANSPORT_RING_SPIN, TRANSPORT_RING_POLL, TRANSPORT_SOCKET } Transport;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void sleep_until(double ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / 1e9);
+    ts.tv_nsec = (long)(ns - (double)ts.tv_sec * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static double env_or(const char *name, double fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atof(value) : fallback;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    int i = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+// Child: send n paced messages, recording how long each send took
+static void produce(Transport t, int fd, int n, double gap_ns, double *cost) {
+    NsrunChannel ch;
+    if (t != TRANSPORT_SOCKET && nsrun_channel_open(&ch) != 0) {
+        fprintf(stderr, "nsrun_channel_open failed\n");
+        _exit(1);
+    }
+
+    double start = now_ns() + 1e6;
+    for (int i = 0; i < n; i++) {
+        sleep_until(start + i * gap_ns);
+        double t0 = now_ns();
+        if (t != TRANSPORT_SOCKET) {
+            // Full only if the consumer stalls; wait for room rather than lose a sample
+            while (nsrun_heartbeat(&ch) != 0) {
+            }
+        } else {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            NsrunMessage m = {
+                .type = NSRUN_MSG_HEARTBEAT,
+                .time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec,
+            };
+            if (send(fd, &m, sizeof(m), 0) != (ssize_t)sizeof(m)) {
+                perror("send");
+                _exit(1);
+            }
+        }
+        cost[i] = now_ns() - t0;
+    }
+    _exit(0);
+}
+
+// Parent: receive n messages, recording send-to-receive latency
+static int consume(Transport t, NsrunRing *ring, int fd, int n, double *lat) {
+    uint64_t tail = 0;
+    long idle_us = POLL_MIN_US;
+    for (int i = 0; i < n; i++) {
+        NsrunMessage m;
+        if (t == TRANSPORT_RING_SPIN) {
+            while (!nsrun_ring_pop(ring, RING_CAPACITY, &tail, &m)) {
+            }
+        } else if (t == TRANSPORT_RING_POLL) {
+            while (!nsrun_ring_pop(ring, RING_CAPACITY, &tail, &m)) {
+                struct timespec ts = { 0, idle_us * 1000L };
+                nanosleep(&ts, NULL);
+                idle_us = idle_us * 2 < POLL_MAX_US ? idle_us * 2 : POLL_MAX_US;
+            }
+            idle_us = POLL_MIN_US;
+        } else if (recv(fd, &m, sizeof(m), 0) != (ssize_t)sizeof(m)) {
+            perror("recv");
+            return -1;
+        }
+        lat[i] = now_ns() - (double)m.time_ns;
+    }
+    return 0;
+}
+
+static int run(Transport t, int n, double gap_ns, double *cost, double *lat) {
+    NsrunRing *ring = NULL;
+    size_t size = NSRUN_RING_SIZE(RING_CAPACITY);
+    int fds[2] = { -1, -1 };
+
+    if (t != TRANSPORT_SOCKET) {
+        fds[0] = memfd_create("nsrun-channel", 0);
+        if (fds[0] < 0 || ftruncate(fds[0], (off_t)size) != 0) {
+            perror("memfd");
+            return -1;
+        }
+        ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        if (ring == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        nsrun_ring_init(ring, RING_CAPACITY);
+        char value[16];
+        snprintf(value, sizeof(value), "%d", fds[0]);
+        setenv(NSRUN_CHANNEL_ENV, value, 1);
+    } else if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        produce(t, fds[1], n, gap_ns, cost);
+    }
+
+    int ret = consume(t, ring, fds[0], n, lat);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ret = -1;
+    }
+
+    if (ring) {
+        munmap(ring, size);
+        unsetenv(NSRUN_CHANNEL_ENV);
+    }
+    close(fds[0]);
+    if (fds[1] >= 0) {
+        close(fds[1]);
+    }
+    return ret;
+}
+
+int main(void) {
+    int n = (int)env_or("BENCH_MESSAGES", 100000);
+    double gap_us = env_or("BENCH_GAP_US", 20);
+    if (n <= 0 || gap_us <= 0) {
+        fprintf(stderr, "BENCH_MESSAGES and BENCH_GAP_US must be > 0\n");
+        return 1;
+    }
+
+    // The producer's costs are written from the child
+    double *cost = mmap(NULL, sizeof(double) * (size_t)n, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    double *lat = malloc(sizeof(double) * (size_t)n);
+    if (cost == MAP_FAILED || !lat) {
+        return 1;
+    }
+
+    printf("messages %d  gap %.0f us  cpus %ld\n", n, gap_us, sysconf(_SC_NPROCESSORS_ONLN));
+    const char *names[] = { "ring/spin", "ring/poll", "unix socket" };
+    for (int t = TRANSPORT_RING_SPIN; t <= TRANSPORT_SOCKET; t++) {
+        if (run((Transport)t, n, gap_us * 1e3, cost, lat) != 0) {
+            return 1;
+        }
+        qsort(cost, (size_t)n, sizeof(double), cmp_double);
+        qsort(lat, (size_t)n, sizeof(double), cmp_double);
+        printf("%-12s send ns  p50 %.0f  p99 %.0f    latency us  p50 %.1f  p99 %.1f  max %.1f\n",
+               names[t], percentile(cost, n, 50), percentile(cost, n, 99),
+               percentile(lat, n, 50) / 1e3, percentile(lat, n, 99) / 1e3, lat[n - 1] / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+// cold_start.c - Launch time with a cold page cache, with and without prewarm
+//
+// Runs `nsrun --rootfs <rootfs> <command>` BENCH_RUNS times each way, with
+// the rootfs evicted from the page cache (prewarm_evict) before every
+// launch: once with --no-prewarm, once letting nsrun queue readahead from
+// <rootfs>.prewarm. A profile is recorded first if there is none. The time
+// is from spawning nsrun to its exit, so pick a command that starts up and
+// exits, such as a server's --version.
+//
+// Usage: sudo bench/cold_start <rootfs> <command>   (from the repository root,
+// or with BENCH_NSRUN pointing at the binary)
+
+#include "prewarm.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run nsrun with one extra option (or none) and its output discarded.
+// Returns the wall time in ms, or -1 if it failed.
+static double launch(const char *nsrun, const char *rootfs, const char *opt, const char *cmd) {
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        if (opt) {
+            execl(nsrun, nsrun, "--rootfs", rootfs, opt, cmd, (char *)NULL);
+        } else {
+            execl(nsrun, nsrun, "--rootfs", rootfs, cmd, (char *)NULL);
+        }
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "%s failed to launch %s\n", nsrun, cmd);
+        return -1;
+    }
+    return now_ms() - start;
+}
+
+static void report(const char *name, double *ms, int n) {
+    qsort(ms, (size_t)n, sizeof(double), cmp_double);
+    printf("%-10s launch ms  min %.1f  p50 %.1f  max %.1f\n", name, ms[0], ms[n / 2], ms[n - 1]);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <rootfs> <command>\n", argv[0]);
+        return 1;
+    }
+    const char *rootfs = argv[1];
+    const char *cmd = argv[2];
+    const char *nsrun = getenv("BENCH_NSRUN") ? getenv("BENCH_NSRUN") : "./nsrun";
+    int runs = getenv("BENCH_RUNS") ? atoi(getenv("BENCH_RUNS")) : 10;
+    if (runs <= 0) {
+        fprintf(stderr, "BENCH_RUNS must be > 0\n");
+        return 1;
+    }
+
+    char profile[4096];
+    if (prewarm_profile_path(rootfs, profile, sizeof(profile)) != 0) {
+        return 1;
+    }
+    if (access(profile, R_OK) != 0) {
+        printf("recording %s\n", profile);
+        if (launch(nsrun, rootfs, "--record-profile=2", cmd) < 0 || access(profile, R_OK) != 0) {
+            fprintf(stderr, "No profile was recorded\n");
+            return 1;
+        }
+    }
+
+    double *cold = malloc(sizeof(double) * (size_t)runs);
+    double *warm = malloc(sizeof(double) * (size_t)runs);
+    if (!cold || !warm) {
+        return 1;
+    }
+    // Interleaved, so drift on the host hits both sides alike
+    for (int i = 0; i < runs; i++) {
+        if (prewarm_evict(rootfs) != 0 ||
+            (cold[i] = launch(nsrun, rootfs, "--no-prewarm", cmd)) < 0 ||
+            prewarm_evict(rootfs) != 0 ||
+            (warm[i] = launch(nsrun, rootfs, NULL, cmd)) < 0) {
+            return 1;
+        }
+    }
+
+    printf("runs %d  rootfs %s  command %s\n", runs, rootfs, cmd);
+    report("cold", cold, runs);
+    report("prewarmed", warm, runs);
+    return 0;
+}
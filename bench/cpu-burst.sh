@@ -0,0 +1,26 @@
+#!/bin/bash
+# cpu-burst.sh - p99 request latency under a CPU quota, with and without burst
+#
+# Runs bench/cpu_burst in a container twice: with a plain quota, then with the
+# same quota plus cpu.max.burst. Clusters of requests need more CPU than one
+# period's quota, so without burst the tail waits out a throttled period.
+#
+# Usage: sudo bench/cpu-burst.sh <rootfs> [seconds]
+
+set -e
+
+cd "$(dirname "$0")/.."
+ROOTFS=${1:?"usage: $0 <rootfs> [seconds]"}
+export BENCH_SECONDS=${2:-10}
+export BENCH_CLUSTER=6 BENCH_WORK_MS=10 BENCH_GAP_MS=500
+
+make all bench >/dev/null
+cp bench/cpu_burst "$ROOTFS/cpu_burst"
+trap 'rm -f "$ROOTFS/cpu_burst"' EXIT
+
+for opts in "--cpu 0.25" "--cpu 0.25 --cpu-burst 25000"; do
+    echo "== nsrun $opts"
+    # shellcheck disable=SC2086
+    ./nsrun --rootfs "$ROOTFS" $opts /cpu_burst
+    echo ""
+done
@@ -0,0 +1,91 @@
+// cpu_burst.c - Request latency under a CPU quota, run inside a container
+//
+// Requests arrive in clusters (open loop): every BENCH_GAP_MS, BENCH_CLUSTER
+// requests each needing BENCH_WORK_MS of CPU. The average load stays well
+// under the quota, but a cluster needs more than one period's quota at once,
+// which is exactly where cpu.max throttles and cpu.max.burst helps. Latency
+// is measured from a request's scheduled arrival to its completion.
+//
+// nsrun passes no arguments to the command, so settings come from the
+// (inherited) environment: BENCH_SECONDS, BENCH_CLUSTER, BENCH_WORK_MS,
+// BENCH_GAP_MS.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// Burn ms of this thread's CPU time; time spent throttled does not count.
+static void work(double ms) {
+    double end = now_ms(CLOCK_THREAD_CPUTIME_ID) + ms;
+    volatile unsigned long x = 0;
+    while (now_ms(CLOCK_THREAD_CPUTIME_ID) < end) {
+        for (int i = 0; i < 1000; i++) {
+            x += (unsigned long)i;
+        }
+    }
+}
+
+static void sleep_until(double ms) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1e3);
+    ts.tv_nsec = (long)((ms - (double)ts.tv_sec * 1e3) * 1e6);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static double env_or(const char *name, double fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atof(value) : fallback;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    int i = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+int main(void) {
+    double seconds = env_or("BENCH_SECONDS", 10);
+    int cluster = (int)env_or("BENCH_CLUSTER", 6);
+    double work_ms = env_or("BENCH_WORK_MS", 10);
+    double gap_ms = env_or("BENCH_GAP_MS", 500);
+    if (seconds <= 0 || cluster <= 0 || work_ms <= 0 || gap_ms <= 0) {
+        fprintf(stderr, "BENCH_SECONDS, BENCH_CLUSTER, BENCH_WORK_MS and BENCH_GAP_MS must be > 0\n");
+        return 1;
+    }
+
+    int max = (int)(seconds * 1e3 / gap_ms + 1) * cluster;
+    double *lat = malloc(sizeof(double) * (size_t)max);
+    if (!lat) {
+        return 1;
+    }
+
+    int n = 0;
+    double start = now_ms(CLOCK_MONOTONIC);
+    for (double arrival = start; arrival < start + seconds * 1e3 && n < max; arrival += gap_ms) {
+        sleep_until(arrival);
+        // The whole cluster arrives at once and is served in order
+        for (int i = 0; i < cluster && n < max; i++) {
+            work(work_ms);
+            lat[n++] = now_ms(CLOCK_MONOTONIC) - arrival;
+        }
+    }
+
+    qsort(lat, (size_t)n, sizeof(double), cmp_double);
+    printf("requests %d  load %.0f%% of one CPU\n", n, 100.0 * cluster * work_ms / gap_ms);
+    printf("latency ms  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(lat, n, 50), percentile(lat, n, 90), percentile(lat, n, 99), lat[n - 1]);
+    free(lat);
+    return 0;
+}
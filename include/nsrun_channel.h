@@ -0,0 +1,209 @@
+// nsrun_channel.h - Workload side of the nsrun control channel (header-only)
+//
+// With --channel, nsrun hands the container a memfd holding a single-producer,
+// single-consumer ring and announces its fd in NSRUN_CHANNEL_FD. The workload
+// writes readiness, heartbeats and metrics into it; the supervisor drains it
+// from a polling thread. Neither side makes a syscall per message.
+//
+//     NsrunChannel ch;
+//     if (nsrun_channel_open(&ch) == 0) {   // -1 outside nsrun: carry on
+//         nsrun_ready(&ch);
+//         nsrun_metric(&ch, "queue_depth", 12);
+//     }
+//
+// Only one thread of one process may send: the ring has a single producer.
+// Sends never block; when the supervisor falls behind they fail and are
+// counted as dropped. Needs C11 atomics and POSIX (build with -D_GNU_SOURCE
+// or -D_POSIX_C_SOURCE=200809L).
+
+#ifndef NSRUN_CHANNEL_H
+#define NSRUN_CHANNEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NSRUN_CHANNEL_ENV "NSRUN_CHANNEL_FD"
+#define NSRUN_CHANNEL_MAGIC 0x6e73636eU  // "nscn"
+#define NSRUN_CHANNEL_VERSION 1
+#define NSRUN_CHANNEL_NAME_MAX 40
+
+typedef enum NsrunMessageType {
+	NSRUN_MSG_READY = 1,  // Startup finished; the container is ready for work
+	NSRUN_MSG_HEARTBEAT,  // Still making progress
+	NSRUN_MSG_METRIC      // name = value
+} NsrunMessageType;
+
+// One message per cache line.
+typedef struct NsrunMessage {
+	uint32_t type;                      // NsrunMessageType
+	uint32_t reserved;
+	uint64_t time_ns;                   // CLOCK_MONOTONIC when sent
+	double value;
+	char name[NSRUN_CHANNEL_NAME_MAX];  // Metric name, NUL-terminated
+} NsrunMessage;
+
+// Start of the shared mapping. Each side writes only its own cache line, so
+// the two never bounce a line they both write.
+typedef struct NsrunRing {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;                    // Slots; a power of two
+	uint32_t message_size;                // sizeof(NsrunMessage)
+	_Alignas(64) _Atomic uint64_t head;   // Producer: messages written so far
+	_Atomic uint64_t dropped;             // Producer: messages lost to a full ring
+	_Alignas(64) _Atomic uint64_t tail;   // Consumer: messages read so far
+	_Alignas(64) NsrunMessage slots[];
+} NsrunRing;
+
+// Bytes needed for a ring of capacity slots.
+#define NSRUN_RING_SIZE(capacity) (sizeof(NsrunRing) + (size_t)(capacity) * sizeof(NsrunMessage))
+
+// Producer handle. head and tail are private copies, so a send that finds
+// room touches the shared tail only when the ring looks full.
+typedef struct NsrunChannel {
+	NsrunRing *ring;
+	size_t size;
+	uint64_t head;
+	uint64_t tail;
+} NsrunChannel;
+
+// Map the ring announced in NSRUN_CHANNEL_ENV. Unsets the variable and closes
+// the fd (the mapping stays), so processes started from here cannot become a
+// second producer. Returns 0 on success, -1 if there is no usable channel.
+static inline int nsrun_channel_open(NsrunChannel *ch) {
+    memset(ch, 0, sizeof(*ch));
+    const char *env = getenv(NSRUN_CHANNEL_ENV);
+    char *end = NULL;
+    long fd = env ? strtol(env, &end, 10) : -1;
+    if (fd < 0 || !end || *end != '\0') {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat((int)fd, &st) != 0 || (size_t)st.st_size < sizeof(NsrunRing)) {
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, (int)fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    NsrunRing *r = (NsrunRing *)map;
+    if (r->magic != NSRUN_CHANNEL_MAGIC || r->version != NSRUN_CHANNEL_VERSION ||
+        r->message_size != sizeof(NsrunMessage) || r->capacity == 0 ||
+        (r->capacity & (r->capacity - 1)) != 0 ||
+        NSRUN_RING_SIZE(r->capacity) > (size_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+
+    unsetenv(NSRUN_CHANNEL_ENV);
+    close((int)fd);
+    ch->ring = r;
+    ch->size = (size_t)st.st_size;
+    ch->head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    ch->tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    return 0;
+}
+
+static inline void nsrun_channel_close(NsrunChannel *ch) {
+    if (ch->ring) {
+        munmap(ch->ring, ch->size);
+    }
+    memset(ch, 0, sizeof(*ch));
+}
+
+// Queue one message. name may be NULL. Returns 0 on success, -1 if the ring
+// is full (the message is dropped and counted) or not open.
+static inline int nsrun_channel_send(NsrunChannel *ch, NsrunMessageType type,
+                                     const char *name, double value) {
+    NsrunRing *r = ch->ring;
+    if (!r) {
+        return -1;
+    }
+    if (ch->head - ch->tail >= r->capacity) {
+        ch->tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (ch->head - ch->tail >= r->capacity) {
+            // Only we write it, so no read-modify-write is needed
+            uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+            atomic_store_explicit(&r->dropped, dropped + 1, memory_order_relaxed);
+            return -1;
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    NsrunMessage *m = &r->slots[ch->head & (r->capacity - 1)];
+    m->type = (uint32_t)type;
+    m->reserved = 0;
+    m->time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    m->value = value;
+    memset(m->name, 0, sizeof(m->name));
+    if (name) {
+        strncpy(m->name, name, sizeof(m->name) - 1);
+    }
+
+    // Publish: the slot's contents become visible before the new head
+    ch->head++;
+    atomic_store_explicit(&r->head, ch->head, memory_order_release);
+    return 0;
+}
+
+static inline int nsrun_ready(NsrunChannel *ch) {
+    return nsrun_channel_send(ch, NSRUN_MSG_READY, NULL, 0);
+}
+
+static inline int nsrun_heartbeat(NsrunChannel *ch) {
+    return nsrun_channel_send(ch, NSRUN_MSG_HEARTBEAT, NULL, 0);
+}
+
+static inline int nsrun_metric(NsrunChannel *ch, const char *name, double value) {
+    return nsrun_channel_send(ch, NSRUN_MSG_METRIC, name, value);
+}
+
+// Host side: lay out an empty ring in a zeroed mapping of
+// NSRUN_RING_SIZE(capacity) bytes. capacity must be a power of two.
+static inline void nsrun_ring_init(NsrunRing *r, uint32_t capacity) {
+    r->magic = NSRUN_CHANNEL_MAGIC;
+    r->version = NSRUN_CHANNEL_VERSION;
+    r->capacity = capacity;
+    r->message_size = sizeof(NsrunMessage);
+    atomic_store_explicit(&r->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&r->dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, 0, memory_order_release);
+}
+
+// Host side: copy the next message into out. The workload can write anywhere
+// in the mapping, so the caller keeps its own tail and capacity and never
+// trusts the shared header; a head more than capacity ahead skips to the
+// newest capacity messages. Returns 1 with a message, 0 if the ring is empty.
+static inline int nsrun_ring_pop(NsrunRing *r, uint32_t capacity, uint64_t *tail,
+                                 NsrunMessage *out) {
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == *tail) {
+        return 0;
+    }
+    if (head - *tail > capacity) {
+        *tail = head - capacity;
+    }
+    memcpy(out, &r->slots[*tail & (capacity - 1)], sizeof(*out));
+    out->name[NSRUN_CHANNEL_NAME_MAX - 1] = '\0';
+    (*tail)++;
+    atomic_store_explicit(&r->tail, *tail, memory_order_release);
+    return 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_CHANNEL_H
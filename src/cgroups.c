@@ -1,10 +1,114 @@
 #include "cgroups.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <fcntl.h> 
 #include <unistd.h>
 
+// cgroup v1 hierarchies a container gets a directory in, each mounted at
+// NSRUN_CGROUP_ROOT/<hierarchy>. The first one mounted answers membership
+// questions (tasks, cgroup.procs); attaching writes to all of them.
+static const char *const v1_hierarchies[] = {
+    "pids", "memory", "cpu", "cpuacct", "freezer", "perf_event"
+};
+#define V1_HIERARCHIES (sizeof(v1_hierarchies) / sizeof(v1_hierarchies[0]))
+
+// cgroup v2 mounted at NSRUN_CGROUP_ROOT itself
+static int unified(void) {
+    return access(NSRUN_CGROUP_ROOT "/cgroup.controllers", F_OK) == 0;
+}
+
+static int v1_mounted(const char *hierarchy) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s/cgroup.procs", NSRUN_CGROUP_ROOT, hierarchy);
+    return access(path, F_OK) == 0;
+}
+
+// Same leaf as name, in a v1 hierarchy
+static void v1_dir(const char *name, const char *hierarchy, char *path, size_t len) {
+    const char *leaf = strrchr(name, '/');
+    snprintf(path, len, "%s/%s/%s", NSRUN_CGROUP_ROOT, hierarchy, leaf ? leaf + 1 : name);
+}
+
+// Neither v2 nor any v1 hierarchy we know: use name as given
+static int v1_any(void) {
+    for (size_t i = 0; i < V1_HIERARCHIES; i++) {
+        if (v1_mounted(v1_hierarchies[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int cgroups_path(const char *name, const char *controller, char *path, size_t len) {
+    if (!name || !path) {
+        return -1;
+    }
+    if (unified()) {
+        snprintf(path, len, "%s", name);
+        return 0;
+    }
+    if (controller) {
+        if (!v1_mounted(controller)) {
+            return -1;
+        }
+        v1_dir(name, controller, path, len);
+        return 0;
+    }
+    for (size_t i = 0; i < V1_HIERARCHIES; i++) {
+        if (v1_mounted(v1_hierarchies[i])) {
+            v1_dir(name, v1_hierarchies[i], path, len);
+            return 0;
+        }
+    }
+    snprintf(path, len, "%s", name);
+    return 0;
+}
+
+// Path of a control file. The controller is the file name up to the first
+// '.' (cpu.max, memory.limit_in_bytes); cgroup.* and tasks are membership
+// files. If the hierarchy is missing, name/file, which then fails to open.
+static void control_path(const char *name, const char *file, char *path, size_t len) {
+    char controller[32] = "";
+    const char *dot = strchr(file, '.');
+    if (dot && (size_t)(dot - file) < sizeof(controller) && strncmp(file, "cgroup.", 7) != 0) {
+        memcpy(controller, file, (size_t)(dot - file));
+        controller[dot - file] = '\0';
+    }
+    char dir[256];
+    if (cgroups_path(name, controller[0] ? controller : NULL, dir, sizeof(dir)) != 0) {
+        snprintf(dir, sizeof(dir), "%s", name);
+    }
+    snprintf(path, len, "%s/%s", dir, file);
+}
+
+// Write a short string to a control file; -1 (quietly) if it does not exist.
+static int write_control(const char *name, const char *file, const char *value) {
+    char path[512];
+    control_path(name, file, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+// Write the v2 control file, or its v1 equivalent (if any) where the v2 one
+// is missing. Reports the failure and returns -1 if neither takes the value.
+static int write_either(const char *name, const char *v2, const char *v1, const char *value) {
+    if (write_control(name, v2, value) == 0 || (v1 && write_control(name, v1, value) == 0)) {
+        return 0;
+    }
+    fprintf(stderr, "Failed to set %s to %s: %s\n", v2, value, strerror(errno));
+    return -1;
+}
 
 // Returns 0 on success, -1 on error.
 int cgroups_create(const char *name) {
@@ -12,12 +116,28 @@ int cgroups_create(const char *name) {
         return -1;
     }
 
-    if (mkdir(name, 0755) != 0) {
-        perror("mkdir");
-        return -1;
+    if (unified() || !v1_any()) {
+        if (mkdir(name, 0755) != 0) {
+            perror("mkdir");
+            return -1;
+        }
+        return 0;
     }
 
-
+    // v1: one directory per hierarchy. Co-mounted hierarchies (cpu,cpuacct)
+    // are the same directory under two names.
+    char path[512];
+    for (size_t i = 0; i < V1_HIERARCHIES; i++) {
+        if (!v1_mounted(v1_hierarchies[i])) {
+            continue;
+        }
+        v1_dir(name, v1_hierarchies[i], path, sizeof(path));
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            perror(path);
+            cgroups_destroy(name);
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -27,59 +147,102 @@ int cgroups_apply_limits(const char *name, const CgroupLimits *limits) {
         return -1;
     }
 
-    char path[256];
+    char path[512];
+    char value[64];
     int fd;
 
-    // Apply memory limit if set
+    // Apply memory limit if set: memory.max on v2, memory.limit_in_bytes on v1
     if (limits->memory_limit_bytes > 0) {
-        snprintf(path, sizeof(path), "%s/memory.limit_in_bytes", name);
-        fd = open(path, O_WRONLY);
-        if (fd < 0) {
-            perror("open memory.limit_in_bytes");
+        snprintf(value, sizeof(value), "%llu", limits->memory_limit_bytes);
+        if (write_either(name, "memory.max", "memory.limit_in_bytes", value) != 0) {
             return -1;
         }
-        if (dprintf(fd, "%llu", limits->memory_limit_bytes) < 0) {
-            perror("dprintf memory.limit_in_bytes");
+    }
+
+    // Apply CPU quota and period if set: cpu.max on v2, the cfs files on v1
+    if (limits->cpu_period_us > 0) {
+        if (limits->cpu_quota_us > 0) {
+            snprintf(value, sizeof(value), "%lld %lld", limits->cpu_quota_us, limits->cpu_period_us);
+        } else {
+            snprintf(value, sizeof(value), "max %lld", limits->cpu_period_us);
+        }
+        if (write_control(name, "cpu.max", value) != 0) {
+            // Set CPU period
+            control_path(name, "cpu.cfs_period_us", path, sizeof(path));
+            fd = open(path, O_WRONLY);
+            if (fd < 0) {
+                perror("open cpu.cfs_period_us");
+                return -1;
+            }
+            if (dprintf(fd, "%lld", limits->cpu_period_us) < 0) {
+                perror("dprintf cpu.cfs_period_us");
+                close(fd);
+                return -1;
+            }
             close(fd);
-            return -1;
+
+            // Set CPU quota
+            if (limits->cpu_quota_us > 0) {
+                control_path(name, "cpu.cfs_quota_us", path, sizeof(path));
+                fd = open(path, O_WRONLY);
+                if (fd < 0) {
+                    perror("open cpu.cfs_quota_us");
+                    return -1;
+                }
+                if (dprintf(fd, "%lld", limits->cpu_quota_us) < 0) {
+                    perror("dprintf cpu.cfs_quota_us");
+                    close(fd);
+                    return -1;
+                }
+                close(fd);
+            }
         }
-        close(fd);
     }
 
-    // Apply CPU quota and period if set
-    if (limits->cpu_quota_us > 0 && limits->cpu_period_us > 0) {
-        // Set CPU period
-        snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", name);
-        fd = open(path, O_WRONLY);
-        if (fd < 0) {
-            perror("open cpu.cfs_period_us");
+    // Burst after the quota: the kernel rejects a burst larger than it
+    if (limits->cpu_burst_us > 0) {
+        snprintf(value, sizeof(value), "%lld", limits->cpu_burst_us);
+        if (write_either(name, "cpu.max.burst", "cpu.cfs_burst_us", value) != 0) {
             return -1;
         }
-        if (dprintf(fd, "%lld", limits->cpu_period_us) < 0) {
-            perror("dprintf cpu.cfs_period_us");
-            close(fd);
-            return -1;
+    }
+
+    // An idle group has no weight of its own, so the two are exclusive
+    if (limits->cpu_idle && write_either(name, "cpu.idle", NULL, "1") != 0) {
+        return -1;
+    }
+    if (limits->cpu_weight > 0) {
+        snprintf(value, sizeof(value), "%d", limits->cpu_weight);
+        if (write_control(name, "cpu.weight", value) != 0) {
+            // v1 shares: weight 100 is the default of 1024 shares
+            snprintf(value, sizeof(value), "%lld", (long long)limits->cpu_weight * 1024 / 100);
+            if (write_either(name, "cpu.shares", NULL, value) != 0) {
+                return -1;
+            }
         }
-        close(fd);
+    }
 
-        // Set CPU quota
-        snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", name);
-        fd = open(path, O_WRONLY);
-        if (fd < 0) {
-            perror("open cpu.cfs_quota_us");
+    // Same files on v1 and v2; "max" (100%) is the kernel's default
+    if (limits->cpu_uclamp_min >= 0) {
+        snprintf(value, sizeof(value), "%.2f", limits->cpu_uclamp_min);
+        if (write_either(name, "cpu.uclamp.min", NULL, value) != 0) {
             return -1;
         }
-        if (dprintf(fd, "%lld", limits->cpu_quota_us) < 0) {
-            perror("dprintf cpu.cfs_quota_us");
-            close(fd);
+    }
+    if (limits->cpu_uclamp_max >= 0) {
+        if (limits->cpu_uclamp_max >= 100) {
+            snprintf(value, sizeof(value), "max");
+        } else {
+            snprintf(value, sizeof(value), "%.2f", limits->cpu_uclamp_max);
+        }
+        if (write_either(name, "cpu.uclamp.max", NULL, value) != 0) {
             return -1;
         }
-        close(fd);
     }
 
     // Apply PIDs limit if set
     if (limits->pids_max > 0) {
-        snprintf(path, sizeof(path), "%s/pids.max", name);
+        control_path(name, "pids.max", path, sizeof(path));
         fd = open(path, O_WRONLY);
         if (fd < 0) {
             perror("open pids.max");
@@ -96,40 +259,301 @@ int cgroups_apply_limits(const char *name, const CgroupLimits *limits) {
     return 0;
 }
 
+// cgroup.procs moves the whole process; tasks is for v1 kernels without it.
+static int open_procs(const char *dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        snprintf(path, sizeof(path), "%s/tasks", dir);
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        perror(path);
+    }
+    return fd;
+}
+
+int cgroups_open_attach(const char *name, int *fds, int max) {
+    if (!name || !fds || max <= 0) {
+        return -1;
+    }
+    if (unified() || !v1_any()) {
+        fds[0] = open_procs(name);
+        return fds[0] < 0 ? -1 : 1;
+    }
+
+    int n = 0;
+    char dir[512];
+    for (size_t i = 0; i < V1_HIERARCHIES && n < max; i++) {
+        if (!v1_mounted(v1_hierarchies[i])) {
+            continue;
+        }
+        v1_dir(name, v1_hierarchies[i], dir, sizeof(dir));
+        fds[n] = open_procs(dir);
+        if (fds[n] < 0) {
+            while (n > 0) {
+                close(fds[--n]);
+            }
+            return -1;
+        }
+        n++;
+    }
+    return n > 0 ? n : -1;
+}
+
+int cgroups_attach_fds(const int *fds, int n, int pid) {
+    if (!fds || n <= 0 || pid < 0) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (dprintf(fds[i], "%d", pid) < 0) {
+            perror("attach to cgroup");
+            return -1;
+        }
+    }
+    return 0;
+}
+
 // Attach a process (pid) to the cgroup. Returns 0 on success, -1 on error.
 int cgroups_attach_pid(const char *name, int pid) {
     if (!name || pid < 0) {
         return -1;
     }
 
-    char path[256];
-    snprintf(path, sizeof(path), "%s/tasks", name);
-    int fd = open(path, O_WRONLY);
-    if (fd < 0) {
-        perror("open");
+    int fds[CGROUPS_MAX_FDS];
+    int n = cgroups_open_attach(name, fds, CGROUPS_MAX_FDS);
+    if (n < 0) {
         return -1;
     }
+    int ret = cgroups_attach_fds(fds, n, pid);
+    for (int i = 0; i < n; i++) {
+        close(fds[i]);
+    }
+    return ret;
+}
 
-    if (dprintf(fd, "%d", pid) < 0) {
-        perror("dprintf");
-        close(fd);
+// Destroy/remove a cgroup. Returns 0 on success, -1 on error.
+int cgroups_destroy(const char *name) {
+    if (!name) {
         return -1;
     }
 
-    close(fd);
-    return 0;
+    if (unified() || !v1_any()) {
+        if (rmdir(name) != 0) {
+            perror("rmdir");
+            return -1;
+        }
+        return 0;
+    }
+
+    int ret = 0;
+    char path[512];
+    for (size_t i = 0; i < V1_HIERARCHIES; i++) {
+        if (!v1_mounted(v1_hierarchies[i])) {
+            continue;
+        }
+        v1_dir(name, v1_hierarchies[i], path, sizeof(path));
+        if (rmdir(path) != 0 && errno != ENOENT) {
+            perror(path);
+            ret = -1;
+        }
+    }
+    return ret;
 }
 
-// Destroy/remove a cgroup. Returns 0 on success, -1 on error.
-int cgroups_destroy(const char *name) {
+int cgroups_exists(const char *name) {
+    char path[512];
     if (!name) {
+        return 0;
+    }
+    control_path(name, "cgroup.procs", path, sizeof(path));
+    if (access(path, F_OK) == 0) {
+        return 1;
+    }
+    control_path(name, "tasks", path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+int cgroups_base_dir(char *path, size_t len) {
+    if (!path) {
         return -1;
     }
+    if (!unified()) {
+        for (size_t i = 0; i < V1_HIERARCHIES; i++) {
+            if (v1_mounted(v1_hierarchies[i])) {
+                snprintf(path, len, "%s/%s", NSRUN_CGROUP_ROOT, v1_hierarchies[i]);
+                return 0;
+            }
+        }
+    }
+    snprintf(path, len, "%s", NSRUN_CGROUP_ROOT);
+    return 0;
+}
+
+// Open the member list: cgroup.procs, or tasks on old v1 kernels. NULL if
+// neither exists.
+static FILE *open_members(const char *name) {
+    char path[512];
+    control_path(name, "cgroup.procs", path, sizeof(path));
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        control_path(name, "tasks", path, sizeof(path));
+        f = fopen(path, "re");
+    }
+    return f;
+}
+
+static void set_frozen(const char *name, int frozen) {
+    if (write_control(name, "cgroup.freeze", frozen ? "1" : "0") != 0) {
+        write_control(name, "freezer.state", frozen ? "FROZEN" : "THAWED");
+    }
+}
 
-    if (rmdir(name) != 0) {
-        perror("rmdir");
+int cgroups_kill(const char *name) {
+    if (!name) {
         return -1;
     }
 
+    // Linux 5.14+: one write kills the whole subtree, including tasks forking
+    if (write_control(name, "cgroup.kill", "1") == 0) {
+        return 0;
+    }
+
+    // Fallback: freeze so nothing can fork behind our back, kill, thaw so
+    // the pending SIGKILLs are delivered
+    set_frozen(name, 1);
+    FILE *f = open_members(name);
+    if (f) {
+        int pid;
+        while (fscanf(f, "%d", &pid) == 1) {
+            if (kill(pid, SIGKILL) != 0 && errno != ESRCH) {
+                perror("kill");
+            }
+        }
+        fclose(f);
+    }
+    set_frozen(name, 0);
     return 0;
 }
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int cgroups_wait_empty(const char *name, int timeout_ms) {
+    if (!name) {
+        return -1;
+    }
+    long long deadline = now_ms() + timeout_ms;
+
+    char path[512];
+    control_path(name, "cgroup.events", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        // v2: cgroup.events raises POLLPRI whenever "populated" flips
+        for (;;) {
+            char buf[256];
+            ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+            if (n < 0) {
+                perror("read cgroup.events");
+                close(fd);
+                return -1;
+            }
+            buf[n] = '\0';
+            if (strstr(buf, "populated 0")) {
+                close(fd);
+                return 0;
+            }
+
+            long long left = deadline - now_ms();
+            if (left <= 0) {
+                close(fd);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            struct pollfd pfd = { .fd = fd, .events = POLLPRI };
+            if (poll(&pfd, 1, (int)left) < 0 && errno != EINTR) {
+                perror("poll cgroup.events");
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    // v1 has no notification for this; poll the member list instead
+    for (;;) {
+        FILE *f = open_members(name);
+        if (!f) {
+            return 0;
+        }
+        int pid;
+        int empty = fscanf(f, "%d", &pid) != 1;
+        fclose(f);
+        if (empty) {
+            return 0;
+        }
+        if (now_ms() >= deadline) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        usleep(10000);
+    }
+}
+
+int cgroups_read_stat(const char *name, const char *file, const char *key,
+                      unsigned long long *value) {
+    if (!name || !file || !value) {
+        return -1;
+    }
+    char path[512];
+    control_path(name, file, path, sizeof(path));
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -1;
+    }
+
+    int ret = -1;
+    char line[256];
+    size_t klen = key ? strlen(key) : 0;
+    while (fgets(line, sizeof(line), f)) {
+        const char *v = line;
+        if (key) {
+            if (strncmp(line, key, klen) != 0 || line[klen] != ' ') {
+                continue;
+            }
+            v = line + klen + 1;
+        }
+        if (strncmp(v, "max", 3) == 0) {
+            *value = ~0ULL;
+            ret = 0;
+        } else {
+            char *end;
+            errno = 0;
+            *value = strtoull(v, &end, 10);
+            ret = end != v && errno == 0 ? 0 : -1;
+        }
+        break;
+    }
+    fclose(f);
+    return ret;
+}
+
+int cgroups_list_pids(const char *name, int *pids, size_t max) {
+    if (!name || (!pids && max > 0)) {
+        return -1;
+    }
+    FILE *f = open_members(name);
+    if (!f) {
+        return -1;
+    }
+    size_t n = 0;
+    int pid;
+    while (n < max && fscanf(f, "%d", &pid) == 1) {
+        pids[n++] = pid;
+    }
+    fclose(f);
+    return (int)n;
+}
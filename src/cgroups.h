@@ -9,6 +9,14 @@ extern "C" {
 
 #include <stddef.h>
 
+// Parent directory for per-container cgroups. Names passed to this API are
+// NSRUN_CGROUP_ROOT/<leaf>; on cgroup v1 the container instead gets
+// NSRUN_CGROUP_ROOT/<hierarchy>/<leaf> in each hierarchy that is mounted.
+#define NSRUN_CGROUP_ROOT "/sys/fs/cgroup"
+
+// Upper bound on the fds cgroups_open_attach returns (one per v1 hierarchy).
+#define CGROUPS_MAX_FDS 8
+
 // Generic cgroup v1/v2 limits supported by this minimal header.
 typedef struct CgroupLimits {
 	// Memory: bytes; 0 means unlimited/not set
@@ -17,6 +25,13 @@ typedef struct CgroupLimits {
 	// CPU: quota/period (cfs). 0 values mean not set.
 	long long cpu_quota_us;  // e.g., 50000 for 50ms quota
 	long long cpu_period_us; // e.g., 100000 for 100ms period
+	long long cpu_burst_us;  // Unused quota that may carry over into a burst (<= quota)
+
+	// CPU scheduling. 0 / negative values mean not set.
+	int cpu_weight;          // Relative share, 1..10000 (kernel default 100)
+	double cpu_uclamp_min;   // Utilization clamp in percent, 0..100; < 0 means not set
+	double cpu_uclamp_max;   // Utilization clamp in percent, 0..100; < 0 means not set
+	int cpu_idle;            // Non-zero: SCHED_IDLE batch class, runs only on idle CPUs
 
 	// PIDs: maximum number of processes; 0 means unlimited
 	long long pids_max;
@@ -32,9 +47,50 @@ int cgroups_apply_limits(const char *name, const CgroupLimits *limits);
 // Attach a process (pid) to the cgroup. Returns 0 on success, -1 on error.
 int cgroups_attach_pid(const char *name, int pid);
 
+// Open the membership files of the cgroup for writing (cgroup.procs, one per
+// v1 hierarchy), so a process can be attached after the host's /sys is out
+// of reach. Returns the number of fds stored in fds, or -1 on error.
+int cgroups_open_attach(const char *name, int *fds, int max);
+
+// Write pid (0 for the caller) to every fd from cgroups_open_attach.
+// Returns 0 on success, -1 on error.
+int cgroups_attach_fds(const int *fds, int n, int pid);
+
+// Directory of the cgroup for one controller ("perf_event", ...), or the one
+// holding membership when controller is NULL. On v2 that is name itself.
+// Returns 0 on success, -1 if the controller's v1 hierarchy is not mounted.
+int cgroups_path(const char *name, const char *controller, char *path, size_t len);
+
+// Non-zero if the cgroup exists.
+int cgroups_exists(const char *name);
+
+// Directory the per-container cgroups are created in (NSRUN_CGROUP_ROOT on
+// v2, the first mounted hierarchy on v1). Returns 0 on success.
+int cgroups_base_dir(char *path, size_t len);
+
 // Destroy/remove a cgroup. Returns 0 on success, -1 on error.
 int cgroups_destroy(const char *name);
 
+// SIGKILL every process in the cgroup: cgroup.kill where available, else
+// freeze, kill each member and thaw. Returns 0 on success, -1 on error.
+int cgroups_kill(const char *name);
+
+// Wait until the cgroup has no processes left ("populated 0" in
+// cgroup.events, or an empty tasks file on v1). Returns 0 once empty,
+// -1 on error or after timeout_ms.
+int cgroups_wait_empty(const char *name, int timeout_ms);
+
+// Read a value from a control file: the "key value" line of a flat keyed
+// file such as cpu.stat, or the whole file when key is NULL (memory.current).
+// "max" reads as ~0ULL. Returns 0 on success, -1 if missing or unparsable.
+int cgroups_read_stat(const char *name, const char *file, const char *key,
+                      unsigned long long *value);
+
+// Fill pids with up to max members of the cgroup: processes from cgroup.procs,
+// or thread ids from tasks on v1. Returns the number stored, or -1 if the
+// cgroup cannot be read.
+int cgroups_list_pids(const char *name, int *pids, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,317 @@
+#include "control.h"
+#include "state.h"
+#include "nsrun_channel.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Idle backoff for the poller: while messages flow it never sleeps; once the
+// ring runs dry it sleeps, doubling from the minimum up to the maximum.
+#define CONTROL_POLL_MIN_US 50
+#define CONTROL_POLL_MAX_US 1000
+
+// Snapshot rewrites are rate-limited; readiness is written straight away.
+#define CONTROL_SNAPSHOT_MS 250
+
+typedef struct ControlMetric {
+    char name[NSRUN_CHANNEL_NAME_MAX];
+    double value;
+} ControlMetric;
+
+struct ControlChannel {
+    char id[64];
+    int trace;
+    int fd;
+    NsrunRing *ring;
+    size_t size;
+    uint32_t capacity;  // Our copy; the workload can rewrite the shared header
+    uint64_t tail;
+    pthread_t thread;
+    int started;
+    atomic_int stop;
+
+    char **env;         // Environment for the command (control_child_env)
+
+    // What the workload reported; times are ns since control_mark_start
+    unsigned long long start_ns;
+    long long ready_ns;  // < 0 until READY
+    long long heartbeat_ns;
+    unsigned long long heartbeats;
+    unsigned long long messages;
+    ControlMetric metrics[CONTROL_MAX_METRICS];
+    int nmetrics;
+    int dirty;
+    unsigned long long written_ns;
+};
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static void sleep_us(long us) {
+    struct timespec ts = { 0, us * 1000L };
+    nanosleep(&ts, NULL);
+}
+
+ControlChannel *control_create(const char *id, int trace) {
+    if (!id) {
+        return NULL;
+    }
+    ControlChannel *cc = calloc(1, sizeof(*cc));
+    if (!cc) {
+        return NULL;
+    }
+    snprintf(cc->id, sizeof(cc->id), "%s", id);
+    cc->trace = trace;
+    cc->capacity = CONTROL_RING_CAPACITY;
+    cc->size = NSRUN_RING_SIZE(cc->capacity);
+    cc->ready_ns = -1;
+    cc->heartbeat_ns = -1;
+    atomic_init(&cc->stop, 0);
+
+    // CLOEXEC until the child clears it, so helpers we spawn (nsenter,
+    // teardown) never see it. Sealed so the workload cannot shrink it and
+    // fault the poller.
+    cc->fd = memfd_create("nsrun-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (cc->fd < 0) {
+        perror("memfd_create");
+        free(cc);
+        return NULL;
+    }
+    if (ftruncate(cc->fd, (off_t)cc->size) != 0 ||
+        fcntl(cc->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        perror("size control channel");
+        close(cc->fd);
+        free(cc);
+        return NULL;
+    }
+    void *map = mmap(NULL, cc->size, PROT_READ | PROT_WRITE, MAP_SHARED, cc->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap control channel");
+        close(cc->fd);
+        free(cc);
+        return NULL;
+    }
+    cc->ring = map;
+    nsrun_ring_init(cc->ring, cc->capacity);
+    return cc;
+}
+
+char **control_child_env(ControlChannel *cc) {
+    if (!cc) {
+        return NULL;
+    }
+    if (cc->env) {
+        return cc->env;
+    }
+    size_t n = 0;
+    while (environ[n]) {
+        n++;
+    }
+    // Ours minus any inherited NSRUN_CHANNEL_FD, plus the new one and NULL
+    char **env = calloc(n + 2, sizeof(*env));
+    char *var = malloc(sizeof(NSRUN_CHANNEL_ENV) + 16);
+    if (!env || !var) {
+        free(env);
+        free(var);
+        return NULL;
+    }
+    size_t len = strlen(NSRUN_CHANNEL_ENV);
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp(environ[i], NSRUN_CHANNEL_ENV, len) != 0 || environ[i][len] != '=') {
+            env[out++] = environ[i];
+        }
+    }
+    snprintf(var, sizeof(NSRUN_CHANNEL_ENV) + 16, "%s=%d", NSRUN_CHANNEL_ENV, cc->fd);
+    env[out++] = var;
+    env[out] = NULL;
+    cc->env = env;
+    return env;
+}
+
+int control_setup_child(ControlChannel *cc) {
+    if (!cc) {
+        return -1;
+    }
+    int flags = fcntl(cc->fd, F_GETFD);
+    if (flags < 0 || fcntl(cc->fd, F_SETFD, flags & ~FD_CLOEXEC) != 0) {
+        perror("fcntl control channel");
+        return -1;
+    }
+    return 0;
+}
+
+void control_mark_start(ControlChannel *cc) {
+    if (cc) {
+        cc->start_ns = now_ns();
+    }
+}
+
+// Metric names end up as keys in a key=value file
+static void sanitize(char *name) {
+    for (char *p = name; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '_' && *p != '.' && *p != '-' && *p != ':') {
+            *p = '_';
+        }
+    }
+}
+
+static void set_metric(ControlChannel *cc, const char *name, double value) {
+    for (int i = 0; i < cc->nmetrics; i++) {
+        if (strcmp(cc->metrics[i].name, name) == 0) {
+            cc->metrics[i].value = value;
+            return;
+        }
+    }
+    if (cc->nmetrics < CONTROL_MAX_METRICS) {
+        ControlMetric *m = &cc->metrics[cc->nmetrics++];
+        snprintf(m->name, sizeof(m->name), "%s", name);
+        m->value = value;
+    }
+}
+
+static long long since_start(const ControlChannel *cc, uint64_t time_ns) {
+    return time_ns > cc->start_ns ? (long long)(time_ns - cc->start_ns) : 0;
+}
+
+// Write <state dir>/channel atomically, like the state record itself
+static void write_snapshot(ControlChannel *cc) {
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+    if (state_path(cc->id, "channel.tmp", tmp, sizeof(tmp)) != 0 ||
+        state_path(cc->id, "channel", path, sizeof(path)) != 0) {
+        return;
+    }
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        return;
+    }
+    fprintf(f, "ready=%d\n", cc->ready_ns >= 0);
+    if (cc->ready_ns >= 0) {
+        fprintf(f, "ready_ms=%.3f\n", (double)cc->ready_ns / 1e6);
+    }
+    fprintf(f, "heartbeats=%llu\n", cc->heartbeats);
+    if (cc->heartbeat_ns >= 0) {
+        fprintf(f, "heartbeat_ms=%.3f\n", (double)cc->heartbeat_ns / 1e6);
+    }
+    fprintf(f, "messages=%llu\n", cc->messages);
+    fprintf(f, "dropped=%llu\n",
+            (unsigned long long)atomic_load_explicit(&cc->ring->dropped, memory_order_relaxed));
+    fprintf(f, "updated_ms=%.3f\n", (double)since_start(cc, now_ns()) / 1e6);
+    for (int i = 0; i < cc->nmetrics; i++) {
+        fprintf(f, "metric.%s=%.17g\n", cc->metrics[i].name, cc->metrics[i].value);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return;
+    }
+    cc->dirty = 0;
+    cc->written_ns = now_ns();
+}
+
+// Pop everything queued. Returns the number of messages handled.
+static int drain(ControlChannel *cc) {
+    NsrunMessage m;
+    int n = 0;
+    while (nsrun_ring_pop(cc->ring, cc->capacity, &cc->tail, &m)) {
+        n++;
+        cc->messages++;
+        cc->dirty = 1;
+        switch (m.type) {
+            case NSRUN_MSG_READY:
+                if (cc->ready_ns < 0) {
+                    cc->ready_ns = since_start(cc, m.time_ns);
+                    if (cc->trace) {
+                        fprintf(stderr, "channel: ready %.1f ms after exec\n",
+                                (double)cc->ready_ns / 1e6);
+                    }
+                    write_snapshot(cc);
+                }
+                break;
+            case NSRUN_MSG_HEARTBEAT:
+                cc->heartbeats++;
+                cc->heartbeat_ns = since_start(cc, m.time_ns);
+                break;
+            case NSRUN_MSG_METRIC:
+                if (m.name[0]) {
+                    sanitize(m.name);
+                    set_metric(cc, m.name, m.value);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return n;
+}
+
+static void *poll_thread(void *arg) {
+    ControlChannel *cc = arg;
+    long idle_us = CONTROL_POLL_MIN_US;
+    while (!atomic_load_explicit(&cc->stop, memory_order_relaxed)) {
+        int n = drain(cc);
+        if (cc->dirty && now_ns() - cc->written_ns >= CONTROL_SNAPSHOT_MS * 1000000ULL) {
+            write_snapshot(cc);
+        }
+        if (n > 0) {
+            idle_us = CONTROL_POLL_MIN_US;
+            continue;
+        }
+        sleep_us(idle_us);
+        if (idle_us < CONTROL_POLL_MAX_US) {
+            idle_us = idle_us * 2 < CONTROL_POLL_MAX_US ? idle_us * 2 : CONTROL_POLL_MAX_US;
+        }
+    }
+    return NULL;
+}
+
+int control_start(ControlChannel *cc) {
+    if (!cc || cc->started) {
+        return -1;
+    }
+    if (cc->start_ns == 0) {
+        cc->start_ns = now_ns();
+    }
+    write_snapshot(cc);
+    if (pthread_create(&cc->thread, NULL, poll_thread, cc) != 0) {
+        fprintf(stderr, "Failed to start control channel poller\n");
+        return -1;
+    }
+    cc->started = 1;
+    return 0;
+}
+
+void control_finish(ControlChannel *cc) {
+    if (!cc) {
+        return;
+    }
+    if (cc->started) {
+        atomic_store_explicit(&cc->stop, 1, memory_order_relaxed);
+        pthread_join(cc->thread, NULL);
+        drain(cc);
+        write_snapshot(cc);
+    }
+    munmap(cc->ring, cc->size);
+    close(cc->fd);
+    if (cc->env) {
+        // Only the last entry is ours; the rest point into environ
+        size_t n = 0;
+        while (cc->env[n]) {
+            n++;
+        }
+        free(cc->env[n - 1]);
+        free(cc->env);
+    }
+    free(cc);
+}
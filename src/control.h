@@ -0,0 +1,48 @@
+// control.h - Supervisor side of the shared-memory control channel (--channel)
+
+#ifndef NSRUN_CONTROL_H
+#define NSRUN_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ring slots per container (64 bytes each).
+#define CONTROL_RING_CAPACITY 1024
+
+// Metrics kept per container; names past this many are ignored.
+#define CONTROL_MAX_METRICS 64
+
+// One container's channel: the memfd ring plus what the workload reported.
+typedef struct ControlChannel ControlChannel;
+
+// Create the memfd and ring for container id. With trace, readiness is
+// reported on stderr. Returns NULL on error.
+ControlChannel *control_create(const char *id, int trace);
+
+// Parent side, before clone: the environment to exec the command with, ours
+// plus NSRUN_CHANNEL_FD. Built here because the child of a multithreaded
+// process must not allocate. Owned by the channel; NULL on error.
+char **control_child_env(ControlChannel *cc);
+
+// Child side, before exec: keep the memfd open across exec.
+// Returns 0 on success, -1 on error.
+int control_setup_child(ControlChannel *cc);
+
+// Parent side, right before the command is released: times reported are
+// relative to this call.
+void control_mark_start(ControlChannel *cc);
+
+// Parent side once the command has been released: drain the ring on a
+// background thread. Returns 0 on success, -1 on error.
+int control_start(ControlChannel *cc);
+
+// Stop the poller, drain what is left, write the final snapshot and free
+// everything. Safe to call with NULL or before control_start.
+void control_finish(ControlChannel *cc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_CONTROL_H
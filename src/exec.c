@@ -0,0 +1,207 @@
+#include "exec.h"
+#include "cgroups.h"
+#include "memory.h"
+#include "state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_NEWCGROUP
+#define CLONE_NEWCGROUP 0x02000000
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// Same layout as the kernel's struct clone_args (CLONE_ARGS_SIZE_VER2).
+struct nsrun_clone_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+// Everything the container's init was created with (see step_clone).
+#define EXEC_NAMESPACES (CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | CLONE_NEWNET)
+
+// Parent pid from /proc/<pid>/stat; 0 if the process is gone.
+static pid_t parent_of(pid_t pid) {
+    char path[64];
+    char buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+
+    // Fields after comm (which may contain spaces): " <state> <ppid> ..."
+    char *p = strrchr(buf, ')');
+    int ppid = 0;
+    if (!p || sscanf(p + 1, " %*c %d", &ppid) != 1) {
+        return 0;
+    }
+    return (pid_t)ppid;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void close_all(const int *fds, int n) {
+    for (int i = 0; i < n; i++) {
+        close(fds[i]);
+    }
+}
+
+// Fork straight into the container's cgroup. Falls back to fork() and a
+// write through attach_fds (cgroup v1, or kernels before 5.7); those were
+// opened on the host, since its /sys is out of reach from here.
+static pid_t spawn_into(int cgroup_fd, const int *attach_fds, int nattach, int *cloned) {
+    *cloned = 0;
+    if (cgroup_fd >= 0) {
+        struct nsrun_clone_args args = {
+            .flags = CLONE_INTO_CGROUP,
+            .exit_signal = SIGCHLD,
+            .cgroup = (uint64_t)cgroup_fd,
+        };
+        long pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid >= 0) {
+            *cloned = 1;
+            return (pid_t)pid;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid == 0 && (nattach <= 0 || cgroups_attach_fds(attach_fds, nattach, 0) != 0)) {
+        fprintf(stderr, "Warning: running outside the container's cgroup\n");
+    }
+    return pid;
+}
+
+int exec_run(const char *id, char *const argv[], int trace) {
+    if (!id || !argv || !argv[0]) {
+        return -1;
+    }
+    double start_ms = now_ms();
+
+    ContainerState st;
+    if (state_load(id, &st) != 0 || st.pid <= 0 || !state_supervisor_alive(&st)) {
+        fprintf(stderr, "No running container %s\n", id);
+        return -1;
+    }
+
+    // The pidfd pins the process; checking its parent afterwards rules out
+    // a recycled pid
+    int pidfd = (int)syscall(SYS_pidfd_open, st.pid, 0);
+    if (pidfd < 0) {
+        perror("pidfd_open");
+        return -1;
+    }
+    if (parent_of(st.pid) != st.supervisor) {
+        fprintf(stderr, "Container %s is no longer running\n", id);
+        close(pidfd);
+        return -1;
+    }
+
+    // Host paths, so open them before switching namespaces
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/root", (int)st.pid);
+    int root = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) {
+        perror("open container root");
+        close(pidfd);
+        return -1;
+    }
+    char cgroup_dir[256];
+    int cgroup_fd = -1;
+    if (cgroups_path(st.cgroup, NULL, cgroup_dir, sizeof(cgroup_dir)) == 0) {
+        cgroup_fd = open(cgroup_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+    int attach_fds[CGROUPS_MAX_FDS];
+    int nattach = cgroups_open_attach(st.cgroup, attach_fds, CGROUPS_MAX_FDS);
+
+    // One call joins them all, atomically
+    int ret = setns(pidfd, EXEC_NAMESPACES);
+    close(pidfd);
+    if (ret != 0) {
+        perror("setns");
+    } else if (fchdir(root) != 0 || chroot(".") != 0 || chdir("/") != 0) {
+        perror("enter container root");
+        ret = -1;
+    }
+    close(root);
+    if (ret != 0) {
+        if (cgroup_fd >= 0) {
+            close(cgroup_fd);
+        }
+        close_all(attach_fds, nattach);
+        return -1;
+    }
+
+    // Joining a PID namespace only applies to children
+    int cloned;
+    pid_t pid = spawn_into(cgroup_fd, attach_fds, nattach, &cloned);
+    if (cgroup_fd >= 0) {
+        close(cgroup_fd);
+    }
+    close_all(attach_fds, nattach);
+    if (pid < 0) {
+        perror("spawn");
+        return -1;
+    }
+    if (pid == 0) {
+        if (trace) {
+            fprintf(stderr, "exec: %s starting %.3f ms after nsrun exec (%s)\n", argv[0],
+                    now_ms() - start_ms, cloned ? "clone3 into cgroup" : "fork + attach");
+        }
+        // The container's own processes got this from its init
+        MemoryPolicy policy = { .ksm = st.ksm, .thp = (ThpMode)st.thp };
+        if (memory_apply_policy(&policy) != 0) {
+            _exit(127);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "exec %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            return -1;
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
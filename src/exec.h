@@ -0,0 +1,20 @@
+// exec.h - Run a command inside an already running container
+
+#ifndef NSRUN_EXEC_H
+#define NSRUN_EXEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Join the namespaces, cgroup and root of container id and run argv there,
+// waiting for it to finish. With trace, prints on stderr how long it took to
+// get the command to its exec. Returns the command's exit code (128 + signal
+// if it was killed), or -1 if it could not be started.
+int exec_run(const char *id, char *const argv[], int trace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_EXEC_H
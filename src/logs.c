@@ -0,0 +1,631 @@
+#include "logs.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_FILE "container.log"
+#define EXIT_FILE "exit"
+#define CONSOLE_CHUNK 4096
+
+// On-disk format: a text header per chunk followed by the raw bytes, so the
+// payload can be spliced straight from the container's pipe:
+//   "<sec>.<nsec> <stdout|stderr> <len>\n" <len bytes>
+
+typedef struct LogStream {
+    const char *tag;      // "stdout" or "stderr"
+    int src;              // Read end of the container's pipe; -1 after EOF
+    int child_fd;         // Write end handed to the container
+    int echo[2];          // Console ring: a pipe sized to buffer_size
+    size_t echo_bytes;    // Bytes currently sitting in the ring
+    int console;          // Our own console fd; -1 if disabled
+    int console_sock;     // Console is a socket: send with MSG_DONTWAIT
+    char pending[CONSOLE_CHUNK]; // Chunk taken from the ring, not yet written
+    size_t pending_off;
+    size_t pending_len;
+    int ring_full;        // Block policy: stop draining src until the ring empties
+    unsigned long long dropped;
+} LogStream;
+
+struct LogCapture {
+    LogConfig cfg;
+    char dir[256];
+    int file;
+    unsigned long long file_size;
+    LogStream streams[2];
+    int poll_map[LOGS_MAX_POLLFDS]; // stream index * 2 + (0 src, 1 console)
+};
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Console writes must never block the supervise loop. Terminals and pipes
+// are reopened through /proc with O_NONBLOCK, so the flag does not leak to
+// whoever shares them (typically the user's shell on the same terminal).
+// Sockets (journald's stdout) cannot be reopened: they are duplicated and
+// written with MSG_DONTWAIT instead, which leaves the shared description
+// blocking. Regular files are duplicated too, keeping their shared offset
+// and O_APPEND, or stdout and stderr redirected to one file overwrite each
+// other; writes to them do not wait on a reader.
+static int open_console(int fd, int *sock) {
+    struct stat st;
+    int ok = fstat(fd, &st) == 0;
+    *sock = ok && S_ISSOCK(st.st_mode);
+    if (ok && (S_ISCHR(st.st_mode) || S_ISFIFO(st.st_mode))) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        int console = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC | O_NOCTTY);
+        if (console >= 0) {
+            return console;
+        }
+    }
+    return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+static int open_log_file(LogCapture *lc) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", lc->dir, LOG_FILE);
+    // No O_APPEND: splice() refuses append-mode files. We are the only writer.
+    lc->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (lc->file < 0) {
+        perror("open container.log");
+        return -1;
+    }
+    lc->file_size = 0;
+    return 0;
+}
+
+// container.log -> .1 -> .2 ... dropping the oldest beyond max_files.
+// The live file always ends up a new inode, which is how followers notice.
+static int rotate(LogCapture *lc) {
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+
+    close(lc->file);
+    if (lc->cfg.max_files == 1) {
+        // Nothing to keep; truncating in place would leave followers
+        // reading from a stale offset in the middle of a record
+        snprintf(from, sizeof(from), "%s/%s", lc->dir, LOG_FILE);
+        if (unlink(from) != 0 && errno != ENOENT) {
+            perror("unlink log");
+        }
+    }
+    for (int i = lc->cfg.max_files - 1; i >= 1; i--) {
+        if (i == 1) {
+            snprintf(from, sizeof(from), "%s/%s", lc->dir, LOG_FILE);
+        } else {
+            snprintf(from, sizeof(from), "%s/%s.%d", lc->dir, LOG_FILE, i - 1);
+        }
+        snprintf(to, sizeof(to), "%s/%s.%d", lc->dir, LOG_FILE, i);
+        if (rename(from, to) != 0 && errno != ENOENT) {
+            perror("rename log");
+        }
+    }
+    return open_log_file(lc);
+}
+
+static int write_record(LogCapture *lc, LogStream *s, size_t len) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    char hdr[96];
+    int n = snprintf(hdr, sizeof(hdr), "%lld.%09ld %s %zu\n",
+                     (long long)ts.tv_sec, ts.tv_nsec, s->tag, len);
+    if (write_all(lc->file, hdr, (size_t)n) != 0) {
+        perror("write log header");
+        return -1;
+    }
+
+    size_t left = len;
+    while (left > 0) {
+        ssize_t moved = splice(s->src, NULL, lc->file, NULL, left, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            perror("splice log");
+            return -1;
+        }
+        left -= (size_t)moved;
+    }
+
+    lc->file_size += (unsigned long long)n + len;
+    if (lc->cfg.max_size > 0 && lc->file_size >= lc->cfg.max_size) {
+        return rotate(lc);
+    }
+    return 0;
+}
+
+static void disable_console(LogStream *s) {
+    if (s->console >= 0) {
+        close(s->console);
+        s->console = -1;
+    }
+    s->ring_full = 0;
+    s->pending_off = s->pending_len = 0;
+}
+
+static int handle_input(LogCapture *lc, LogStream *s) {
+    int avail = 0;
+    if (ioctl(s->src, FIONREAD, &avail) != 0) {
+        perror("ioctl FIONREAD");
+        return -1;
+    }
+    if (avail == 0) {
+        // Readable with nothing buffered: every writer is gone
+        close(s->src);
+        s->src = -1;
+        return 0;
+    }
+
+    size_t chunk = (size_t)avail;
+    if (s->console >= 0) {
+        // Copy (not consume) into the console ring before the splice below
+        ssize_t copied = tee(s->src, s->echo[1], chunk, SPLICE_F_NONBLOCK);
+        if (copied < 0 && errno != EAGAIN) {
+            perror("tee");
+            return -1;
+        }
+        if (copied < 0) {
+            copied = 0;
+        }
+        if ((size_t)copied < chunk) {
+            if (lc->cfg.policy == LOG_POLICY_BLOCK) {
+                s->ring_full = 1;
+                if (copied == 0) {
+                    return 0;
+                }
+                chunk = (size_t)copied;
+            } else {
+                s->dropped += chunk - (size_t)copied;
+            }
+        }
+        s->echo_bytes += (size_t)copied;
+    }
+    return write_record(lc, s, chunk);
+}
+
+static void drain_console(LogStream *s) {
+    while (s->console >= 0) {
+        if (s->pending_off == s->pending_len) {
+            if (s->echo_bytes == 0) {
+                s->ring_full = 0;
+                return;
+            }
+            ssize_t n = read(s->echo[0], s->pending, sizeof(s->pending));
+            if (n <= 0) {
+                s->echo_bytes = 0;
+                return;
+            }
+            s->pending_off = 0;
+            s->pending_len = (size_t)n;
+            s->echo_bytes -= (size_t)n;
+            s->ring_full = 0;
+        }
+
+        const char *buf = s->pending + s->pending_off;
+        size_t len = s->pending_len - s->pending_off;
+        ssize_t w = s->console_sock ? send(s->console, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL)
+                                    : write(s->console, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // Console went away (EPIPE etc.); keep logging to the file
+                disable_console(s);
+            }
+            return;
+        }
+        s->pending_off += (size_t)w;
+    }
+}
+
+static int init_stream(LogCapture *lc, LogStream *s, const char *tag, int console_fd) {
+    int p[2];
+    s->tag = tag;
+
+    if (pipe2(p, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        return -1;
+    }
+    s->src = p[0];
+    s->child_fd = p[1];
+    fcntl(s->src, F_SETFL, O_NONBLOCK);
+
+    if (!lc->cfg.console) {
+        return 0;
+    }
+    if (pipe2(s->echo, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe2");
+        return -1;
+    }
+    if (lc->cfg.buffer_size > 0 &&
+        fcntl(s->echo[1], F_SETPIPE_SZ, (int)lc->cfg.buffer_size) < 0) {
+        perror("F_SETPIPE_SZ");
+    }
+    s->console = open_console(console_fd, &s->console_sock);
+    if (s->console < 0) {
+        perror("open console");
+        return -1;
+    }
+    return 0;
+}
+
+static void close_stream(LogStream *s) {
+    int *fds[] = { &s->src, &s->child_fd, &s->echo[0], &s->echo[1], &s->console };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+}
+
+int logs_dir(const char *id, char *path, size_t len) {
+    if (!id || !*id || strchr(id, '/') || strcmp(id, ".") == 0 || strcmp(id, "..") == 0) {
+        return -1;
+    }
+    if ((size_t)snprintf(path, len, "%s/%s", NSRUN_LOG_DIR, id) >= len) {
+        return -1;
+    }
+    return 0;
+}
+
+LogCapture *logs_create(const char *id, const LogConfig *cfg) {
+    if (!cfg) {
+        return NULL;
+    }
+    LogCapture *lc = calloc(1, sizeof(LogCapture));
+    if (!lc) {
+        return NULL;
+    }
+    lc->cfg = *cfg;
+    if (lc->cfg.max_files < 1) {
+        lc->cfg.max_files = 1;
+    }
+    lc->file = -1;
+    for (int i = 0; i < 2; i++) {
+        LogStream *s = &lc->streams[i];
+        s->src = s->child_fd = s->console = -1;
+        s->echo[0] = s->echo[1] = -1;
+    }
+
+    if (logs_dir(id, lc->dir, sizeof(lc->dir)) != 0 || util_mkdir_p(lc->dir, 0750) != 0) {
+        perror("create log directory");
+        free(lc);
+        return NULL;
+    }
+
+    // Ids can be reused (they follow the supervisor pid): start from scratch
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", lc->dir, EXIT_FILE);
+    unlink(path);
+    for (int i = 1; ; i++) {
+        snprintf(path, sizeof(path), "%s/%s.%d", lc->dir, LOG_FILE, i);
+        if (unlink(path) != 0) {
+            break;
+        }
+    }
+
+    if (open_log_file(lc) != 0 ||
+        init_stream(lc, &lc->streams[0], "stdout", STDOUT_FILENO) != 0 ||
+        init_stream(lc, &lc->streams[1], "stderr", STDERR_FILENO) != 0) {
+        logs_finish(lc, -1);
+        return NULL;
+    }
+    return lc;
+}
+
+int logs_setup_child(LogCapture *lc) {
+    if (!lc) {
+        return -1;
+    }
+    // dup2 clears FD_CLOEXEC on the copies; everything else closes on exec
+    if (dup2(lc->streams[0].child_fd, STDOUT_FILENO) < 0 ||
+        dup2(lc->streams[1].child_fd, STDERR_FILENO) < 0) {
+        perror("dup2 log pipe");
+        return -1;
+    }
+    return 0;
+}
+
+void logs_parent_after_clone(LogCapture *lc) {
+    if (!lc) {
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (lc->streams[i].child_fd >= 0) {
+            close(lc->streams[i].child_fd);
+            lc->streams[i].child_fd = -1;
+        }
+    }
+}
+
+int logs_poll_fds(LogCapture *lc, struct pollfd *fds, int max) {
+    int n = 0;
+    for (int i = 0; i < 2 && n < max; i++) {
+        LogStream *s = &lc->streams[i];
+        if (s->src >= 0 && !s->ring_full) {
+            fds[n].fd = s->src;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            lc->poll_map[n++] = i * 2;
+        }
+        if (n < max && s->console >= 0 &&
+            (s->echo_bytes > 0 || s->pending_off < s->pending_len)) {
+            fds[n].fd = s->console;
+            fds[n].events = POLLOUT;
+            fds[n].revents = 0;
+            lc->poll_map[n++] = i * 2 + 1;
+        }
+    }
+    return n;
+}
+
+int logs_handle(LogCapture *lc, const struct pollfd *fds, int nfds) {
+    for (int k = 0; k < nfds; k++) {
+        if (!fds[k].revents) {
+            continue;
+        }
+        LogStream *s = &lc->streams[lc->poll_map[k] / 2];
+        if (lc->poll_map[k] % 2 == 0) {
+            if (handle_input(lc, s) != 0) {
+                return -1;
+            }
+        } else if (fds[k].revents & (POLLERR | POLLHUP)) {
+            disable_console(s);
+        } else {
+            drain_console(s);
+        }
+    }
+    return 0;
+}
+
+int logs_done(const LogCapture *lc) {
+    for (int i = 0; i < 2; i++) {
+        const LogStream *s = &lc->streams[i];
+        if (s->src >= 0) {
+            return 0;
+        }
+        if (s->console >= 0 && (s->echo_bytes > 0 || s->pending_off < s->pending_len)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void logs_finish(LogCapture *lc, int exit_code) {
+    if (!lc) {
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (lc->streams[i].dropped > 0) {
+            fprintf(stderr, "nsrun: console fell behind, skipped %llu bytes of %s (kept in %s/%s)\n",
+                    lc->streams[i].dropped, lc->streams[i].tag, lc->dir, LOG_FILE);
+        }
+        close_stream(&lc->streams[i]);
+    }
+    if (lc->file >= 0) {
+        close(lc->file);
+    }
+
+    if (exit_code >= 0) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", lc->dir, EXIT_FILE);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+        if (fd >= 0) {
+            dprintf(fd, "%d\n", exit_code);
+            close(fd);
+        }
+    }
+    free(lc);
+}
+
+// Reader side
+
+typedef struct LogReader {
+    int timestamps;
+    int line_start[2]; // Per stream: next byte begins a new line
+    char *buf;
+    size_t cap;
+} LogReader;
+
+static void emit(LogReader *r, int stream, const struct timespec *ts,
+                 const char *data, size_t len) {
+    FILE *out = stream == 0 ? stdout : stderr;
+    if (!r->timestamps) {
+        fwrite(data, 1, len, out);
+        return;
+    }
+
+    char stamp[64];
+    struct tm tm;
+    gmtime_r(&ts->tv_sec, &tm);
+    size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(stamp + n, sizeof(stamp) - n, ".%09ldZ ", ts->tv_nsec);
+
+    while (len > 0) {
+        if (r->line_start[stream]) {
+            fputs(stamp, out);
+        }
+        const char *nl = memchr(data, '\n', len);
+        size_t seg = nl ? (size_t)(nl - data) + 1 : len;
+        fwrite(data, 1, seg, out);
+        r->line_start[stream] = nl != NULL;
+        data += seg;
+        len -= seg;
+    }
+}
+
+// Print every complete record from the current position. A trailing partial
+// record is left unread for the next call. Returns 0, or -1 on corruption.
+static int print_records(LogReader *r, FILE *f) {
+    for (;;) {
+        long start = ftell(f);
+        char hdr[96];
+        if (!fgets(hdr, sizeof(hdr), f) || !strchr(hdr, '\n')) {
+            clearerr(f);
+            fseek(f, start, SEEK_SET);
+            return 0;
+        }
+
+        long long sec;
+        long nsec;
+        char tag[8];
+        size_t len;
+        if (sscanf(hdr, "%lld.%ld %7s %zu", &sec, &nsec, tag, &len) != 4) {
+            fprintf(stderr, "nsrun: corrupt log record at offset %ld\n", start);
+            return -1;
+        }
+        if (len > r->cap) {
+            char *buf = realloc(r->buf, len);
+            if (!buf) {
+                return -1;
+            }
+            r->buf = buf;
+            r->cap = len;
+        }
+        if (fread(r->buf, 1, len, f) != len) {
+            clearerr(f);
+            fseek(f, start, SEEK_SET);
+            return 0;
+        }
+
+        struct timespec ts = { .tv_sec = (time_t)sec, .tv_nsec = nsec };
+        emit(r, strcmp(tag, "stderr") == 0 ? 1 : 0, &ts, r->buf, len);
+    }
+}
+
+static int print_file(LogReader *r, const char *path) {
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    int ret = print_records(r, f);
+    fclose(f);
+    return ret;
+}
+
+int logs_print(const char *id, int follow, int timestamps) {
+    char dir[256];
+    char path[512];
+    char exit_path[512];
+    if (logs_dir(id, dir, sizeof(dir)) != 0) {
+        fprintf(stderr, "Invalid container id '%s'\n", id ? id : "");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, LOG_FILE);
+    snprintf(exit_path, sizeof(exit_path), "%s/%s", dir, EXIT_FILE);
+
+    LogReader r = { .timestamps = timestamps, .line_start = { 1, 1 } };
+
+    // Watch before reading anything so no write can slip between the two
+    int in = -1;
+    if (follow) {
+        in = inotify_init1(IN_CLOEXEC);
+        if (in < 0 || inotify_add_watch(in, dir, IN_MODIFY | IN_CREATE | IN_MOVED_TO) < 0) {
+            perror(dir);
+            if (in >= 0) {
+                close(in);
+            }
+            return -1;
+        }
+    }
+
+    // Rotated files first, oldest to newest
+    int oldest = 0;
+    for (;;) {
+        char rotated[PATH_MAX];
+        snprintf(rotated, sizeof(rotated), "%s.%d", path, oldest + 1);
+        if (access(rotated, F_OK) != 0) {
+            break;
+        }
+        oldest++;
+    }
+    for (int i = oldest; i >= 1; i--) {
+        char rotated[PATH_MAX];
+        snprintf(rotated, sizeof(rotated), "%s.%d", path, i);
+        print_file(&r, rotated);
+    }
+
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        perror(path);
+        free(r.buf);
+        if (in >= 0) {
+            close(in);
+        }
+        return -1;
+    }
+
+    int ret = 0;
+    for (;;) {
+        // Check for exit before draining: the supervisor writes it last
+        int exited = !follow || access(exit_path, F_OK) == 0;
+        if (print_records(&r, f) != 0) {
+            ret = -1;
+            break;
+        }
+        fflush(stdout);
+        fflush(stderr);
+
+        struct stat cur;
+        struct stat now;
+        if (follow && fstat(fileno(f), &cur) == 0 && stat(path, &now) == 0 &&
+            cur.st_ino == now.st_ino && now.st_size < ftell(f)) {
+            // Truncated in place (an older nsrun): start over from the top
+            fseek(f, 0, SEEK_SET);
+            continue;
+        }
+        if (follow && fstat(fileno(f), &cur) == 0 && stat(path, &now) == 0 &&
+            cur.st_ino != now.st_ino) {
+            // Rotated under us: finish the old file, then switch
+            print_records(&r, f);
+            FILE *next = fopen(path, "re");
+            if (next) {
+                fclose(f);
+                f = next;
+                continue;
+            }
+        }
+        if (exited) {
+            break;
+        }
+
+        char events[4096];
+        if (read(in, events, sizeof(events)) < 0 && errno != EINTR) {
+            perror("read inotify");
+            ret = -1;
+            break;
+        }
+    }
+
+    fclose(f);
+    free(r.buf);
+    if (in >= 0) {
+        close(in);
+    }
+    return ret;
+}
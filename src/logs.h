@@ -0,0 +1,69 @@
+// logs.h - Container stdout/stderr capture, rotation and following
+
+#ifndef NSRUN_LOGS_H
+#define NSRUN_LOGS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>
+#include <stddef.h>
+
+// Per-container logs live in NSRUN_LOG_DIR/<id>/container.log(.N)
+#define NSRUN_LOG_DIR "/var/log/nsrun"
+
+// What to do when the console cannot keep up with the container's output.
+typedef enum LogPolicy {
+	LOG_POLICY_DROP,  // Keep draining the container; skip console output
+	LOG_POLICY_BLOCK  // Stop draining the container until the console catches up
+} LogPolicy;
+
+typedef struct LogConfig {
+	unsigned long long max_size; // Rotate container.log at this size; 0 means never
+	int max_files;               // Files kept including the live one (>= 1)
+	size_t buffer_size;          // Console ring size per stream in bytes
+	LogPolicy policy;
+	int console;                 // Non-zero to also echo output to our stdout/stderr
+} LogConfig;
+
+// Capture state for one container (both streams, log file, console rings).
+typedef struct LogCapture LogCapture;
+
+// Upper bound on the pollfds logs_poll_fds fills in.
+#define LOGS_MAX_POLLFDS 4
+
+// Create the log directory, open container.log and the capture pipes.
+// Returns NULL on error.
+LogCapture *logs_create(const char *id, const LogConfig *cfg);
+
+// Child side: make the capture pipes the child's stdout/stderr. 0 on success.
+int logs_setup_child(LogCapture *lc);
+
+// Parent side after clone: drop our copies of the pipe write ends.
+void logs_parent_after_clone(LogCapture *lc);
+
+// Fill fds with what the supervisor loop should poll; returns the count.
+int logs_poll_fds(LogCapture *lc, struct pollfd *fds, int max);
+
+// Handle poll results for the fds returned by logs_poll_fds. 0 on success.
+int logs_handle(LogCapture *lc, const struct pollfd *fds, int nfds);
+
+// Non-zero once both streams hit EOF and all console output is flushed.
+int logs_done(const LogCapture *lc);
+
+// Record the container's exit so followers know to stop, then free everything.
+void logs_finish(LogCapture *lc, int exit_code);
+
+// Path of the log directory for a container id.
+int logs_dir(const char *id, char *path, size_t len);
+
+// Print a container's logs; with follow, keep going until it exits.
+// Returns 0 on success, -1 on error.
+int logs_print(const char *id, int follow, int timestamps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_LOGS_H
@@ -12,11 +12,26 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include "container.h"
 #include "namespace.h"
 #include "cgroups.h"
 #include "network.h"
+#include "mounts.h"
+#include "logs.h"
+#include "state.h"
+#include "teardown.h"
+#include "pipeline.h"
+#include "prewarm.h"
+#include "stats.h"
+#include "exec.h"
+#include "memory.h"
+#include "control.h"
 
 // stack allocation for child process
 #define STACK_SIZE (1024 * 1024) // 1MB
@@ -30,14 +45,69 @@ struct ContainerConfig {
     unsigned long long memory_limit_bytes;
     long long cpu_quota_us;
     long long cpu_period_us;
+    long long cpu_burst_us;
+    int cpu_weight;
+    double cpu_uclamp_min; // < 0 means not set
+    double cpu_uclamp_max; // < 0 means not set
+    int cpu_idle;
     long long pids_max;
+    MemoryPolicy memory;
+    int channel;               // Non-zero: shared-memory control channel (--channel)
+    ControlChannel *control;
+    char **child_env;          // Environment for the command; NULL for ours
     char *bridge_name;
-    char *host_if;
-    char *cont_if;
+    char host_if[16];          // Host end of the veth pair, unique per container
+    char cont_if[16];          // Container end while it is still on the host
+    char *cont_if_name;        // Container end once moved into the container
     char *cont_ip;
     char *gateway;
+    MountVolume *volumes;
+    int read_only;
+    char template_path[256];
+    int detach;
+    LogConfig log;
+    LogCapture *logs;
+    char id[64];
+    int trace;
+    int record_window_ms; // > 0: record a prewarm profile this long after launch
+    int no_prewarm;
+    char prewarm_profile[512];
+    int child_ready[2]; // child -> parent: hostname and mounts are set up
+    int child_go[2];    // parent -> child: host side is done, exec now
 };
 
+// Long-only options (no short letter)
+enum {
+    OPT_LOG_MAX_SIZE = 256,
+    OPT_LOG_MAX_FILES,
+    OPT_LOG_BUFFER,
+    OPT_LOG_POLICY,
+    OPT_TRACE,
+    OPT_RECORD_PROFILE,
+    OPT_NO_PREWARM,
+    OPT_CPU_PERIOD,
+    OPT_CPU_BURST,
+    OPT_CPU_WEIGHT,
+    OPT_CPU_UCLAMP_MIN,
+    OPT_CPU_UCLAMP_MAX,
+    OPT_CPU_IDLE,
+    OPT_KSM,
+    OPT_THP,
+    OPT_CHANNEL
+};
+
+// Parse a byte count with optional K/M/G suffix
+static unsigned long long parse_size(const char *arg) {
+    char *end = NULL;
+    unsigned long long value = strtoull(arg, &end, 10);
+    switch (end ? *end : '\0') {
+        case 'k': case 'K': return value * 1024ULL;
+        case 'm': case 'M': return value * 1024ULL * 1024ULL;
+        case 'g': case 'G': return value * 1024ULL * 1024ULL * 1024ULL;
+        default: return value;
+    }
+}
+
 // Parse command line arguments
 int parse_args(int argc, char *argv[], struct ContainerConfig *config) {
     static struct option long_options[] = {
@@ -49,11 +119,32 @@ int parse_args(int argc, char *argv[], struct ContainerConfig *config) {
         {"bridge", required_argument, 0, 'b'},
         {"ip", required_argument, 0, 'i'},
         {"gateway", required_argument, 0, 'g'},
+        {"volume", required_argument, 0, 'v'},
+        {"read-only", no_argument, 0, 'R'},
+        {"detach", no_argument, 0, 'd'},
+        {"log-max-size", required_argument, 0, OPT_LOG_MAX_SIZE},
+        {"log-max-files", required_argument, 0, OPT_LOG_MAX_FILES},
+        {"log-buffer", required_argument, 0, OPT_LOG_BUFFER},
+        {"log-policy", required_argument, 0, OPT_LOG_POLICY},
+        {"trace", no_argument, 0, OPT_TRACE},
+        {"record-profile", optional_argument, 0, OPT_RECORD_PROFILE},
+        {"no-prewarm", no_argument, 0, OPT_NO_PREWARM},
+        {"cpu-period", required_argument, 0, OPT_CPU_PERIOD},
+        {"cpu-burst", required_argument, 0, OPT_CPU_BURST},
+        {"cpu-weight", required_argument, 0, OPT_CPU_WEIGHT},
+        {"cpu-uclamp-min", required_argument, 0, OPT_CPU_UCLAMP_MIN},
+        {"cpu-uclamp-max", required_argument, 0, OPT_CPU_UCLAMP_MAX},
+        {"cpu-idle", no_argument, 0, OPT_CPU_IDLE},
+        {"ksm", no_argument, 0, OPT_KSM},
+        {"thp", required_argument, 0, OPT_THP},
+        {"channel", no_argument, 0, OPT_CHANNEL},
         {0, 0, 0, 0}
     };
+    double cpu_fraction = 0;
+    int console_opts = 0; // --log-buffer or --log-policy given
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "r:h:m:c:p:b:i:g:", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "r:h:m:c:p:b:i:g:v:Rd", long_options, NULL)) != -1) {
         switch (opt) {
             case 'r':
                 config->rootfs = strdup(optarg);
@@ -62,21 +153,12 @@ int parse_args(int argc, char *argv[], struct ContainerConfig *config) {
                 config->hostname = strdup(optarg);
                 break;
             case 'm':
-                // Parse memory (support M, G suffixes)
-                config->memory_limit_bytes = strtoull(optarg, NULL, 10);
-                if (strstr(optarg, "M") || strstr(optarg, "m")) {
-                    config->memory_limit_bytes *= 1024 * 1024;
-                } else if (strstr(optarg, "G") || strstr(optarg, "g")) {
-                    config->memory_limit_bytes *= 1024 * 1024 * 1024;
-                }
+                // Parse memory (support K, M, G suffixes)
+                config->memory_limit_bytes = parse_size(optarg);
                 break;
             case 'c':
-                // Parse CPU as fraction (e.g., 0.5 = 50% = 50000/100000)
-                {
-                    double cpu_fraction = strtod(optarg, NULL);
-                    config->cpu_period_us = 100000; // 100ms
-                    config->cpu_quota_us = (long long)(cpu_fraction * 100000);
-                }
+                // Parse CPU as fraction of the period (e.g., 0.5 = 50000/100000)
+                cpu_fraction = strtod(optarg, NULL);
                 break;
             case 'p':
                 config->pids_max = strtoll(optarg, NULL, 10);
@@ -90,11 +172,153 @@ int parse_args(int argc, char *argv[], struct ContainerConfig *config) {
             case 'g':
                 config->gateway = strdup(optarg);
                 break;
+            case 'v':
+                // Parse host:container[:ro]; keep command-line order
+                {
+                    MountVolume *vol = mounts_parse_volume(optarg);
+                    if (!vol) {
+                        fprintf(stderr, "Invalid volume '%s' (expected host:container[:ro])\n", optarg);
+                        return -1;
+                    }
+                    MountVolume **tail = &config->volumes;
+                    while (*tail) {
+                        tail = &(*tail)->next;
+                    }
+                    *tail = vol;
+                }
+                break;
+            case 'R':
+                config->read_only = 1;
+                break;
+            case 'd':
+                config->detach = 1;
+                break;
+            case OPT_LOG_MAX_SIZE:
+                config->log.max_size = parse_size(optarg);
+                break;
+            case OPT_LOG_MAX_FILES:
+                config->log.max_files = atoi(optarg);
+                break;
+            case OPT_LOG_BUFFER:
+                config->log.buffer_size = (size_t)parse_size(optarg);
+                console_opts = 1;
+                break;
+            case OPT_LOG_POLICY:
+                console_opts = 1;
+                if (strcmp(optarg, "drop") == 0) {
+                    config->log.policy = LOG_POLICY_DROP;
+                } else if (strcmp(optarg, "block") == 0) {
+                    config->log.policy = LOG_POLICY_BLOCK;
+                } else {
+                    fprintf(stderr, "Invalid log policy '%s' (expected drop or block)\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_TRACE:
+                config->trace = 1;
+                break;
+            case OPT_RECORD_PROFILE:
+                // Optional window in seconds (--record-profile=10)
+                config->record_window_ms = optarg ? (int)(strtod(optarg, NULL) * 1000)
+                                                  : PREWARM_RECORD_WINDOW_MS;
+                if (config->record_window_ms <= 0) {
+                    fprintf(stderr, "Invalid recording window '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case OPT_NO_PREWARM:
+                config->no_prewarm = 1;
+                break;
+            case OPT_CPU_PERIOD:
+                config->cpu_period_us = strtoll(optarg, NULL, 10);
+                break;
+            case OPT_CPU_BURST:
+                config->cpu_burst_us = strtoll(optarg, NULL, 10);
+                break;
+            case OPT_CPU_WEIGHT:
+                {
+                    // 0 would silently mean "not set"
+                    char *end = NULL;
+                    long weight = strtol(optarg, &end, 10);
+                    if (end == optarg || *end != '\0' || weight < 1 || weight > 10000) {
+                        fprintf(stderr, "Invalid --cpu-weight '%s' (expected 1..10000)\n", optarg);
+                        return -1;
+                    }
+                    config->cpu_weight = (int)weight;
+                }
+                break;
+            case OPT_CPU_UCLAMP_MIN:
+            case OPT_CPU_UCLAMP_MAX:
+                {
+                    double pct = strtod(optarg, NULL);
+                    if (pct < 0) {
+                        fprintf(stderr, "Invalid utilization clamp '%s'\n", optarg);
+                        return -1;
+                    }
+                    if (opt == OPT_CPU_UCLAMP_MIN) {
+                        config->cpu_uclamp_min = pct;
+                    } else {
+                        config->cpu_uclamp_max = pct;
+                    }
+                }
+                break;
+            case OPT_CPU_IDLE:
+                config->cpu_idle = 1;
+                break;
+            case OPT_KSM:
+                config->memory.ksm = 1;
+                break;
+            case OPT_THP:
+                if (memory_parse_thp(optarg, &config->memory.thp) != 0) {
+                    fprintf(stderr, "Invalid THP mode '%s' (expected inherit, never or madvise)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case OPT_CHANNEL:
+                config->channel = 1;
+                break;
             default:
                 return -1;
         }
     }
 
+    // Quota follows the period, whichever order they were given in
+    if (cpu_fraction > 0) {
+        if (config->cpu_period_us <= 0) {
+            config->cpu_period_us = 100000; // 100ms
+        }
+        config->cpu_quota_us = (long long)(cpu_fraction * (double)config->cpu_period_us);
+    }
+    if (config->cpu_period_us < 0 ||
+        (config->cpu_period_us > 0 && (config->cpu_period_us < 1000 || config->cpu_period_us > 1000000))) {
+        fprintf(stderr, "Invalid --cpu-period (expected 1000..1000000 us)\n");
+        return -1;
+    }
+    if (config->cpu_burst_us < 0 ||
+        (config->cpu_burst_us > 0 && config->cpu_burst_us > config->cpu_quota_us)) {
+        fprintf(stderr, "--cpu-burst needs --cpu and may not exceed the quota (%lld us)\n",
+                config->cpu_quota_us);
+        return -1;
+    }
+    if (config->cpu_idle && config->cpu_weight > 0) {
+        fprintf(stderr, "--cpu-idle and --cpu-weight are mutually exclusive\n");
+        return -1;
+    }
+    // container.log is always drained at full speed; only the console echo
+    // is buffered, and a detached container has none
+    if (config->detach && console_opts) {
+        fprintf(stderr, "--log-buffer and --log-policy only apply to console output, "
+                        "which --detach turns off\n");
+        return -1;
+    }
+    if (config->cpu_uclamp_min > 100 || config->cpu_uclamp_max > 100 ||
+        (config->cpu_uclamp_min >= 0 && config->cpu_uclamp_max >= 0 &&
+         config->cpu_uclamp_min > config->cpu_uclamp_max)) {
+        fprintf(stderr, "Invalid --cpu-uclamp-min/max (expected 0..100, min <= max)\n");
+        return -1;
+    }
+
     // Command is the remaining argument
     if (optind < argc) {
         config->command = strdup(argv[optind]);
@@ -107,37 +331,566 @@ int parse_args(int argc, char *argv[], struct ContainerConfig *config) {
 int child_func(void *arg) {
     struct ContainerConfig *config = (struct ContainerConfig *)arg;
 
+    // step_clone held the stdio locks across clone; this copy owns them
+    funlockfile(stderr);
+    funlockfile(stdout);
+
+    // Route stdout/stderr through the log capture pipes
+    if (logs_setup_child(config->logs) != 0) {
+        return 1;
+    }
+    close(config->child_ready[0]);
+    close(config->child_go[1]);
+
     // Set hostname in UTS namespace
     if (config->hostname && sethostname(config->hostname, strlen(config->hostname)) != 0) {
         perror("sethostname failed");
         return 1;
     }
 
-    // Configure network interface if specified
-    if (config->cont_if && config->cont_ip) {
-        if (net_configure_if_in_ns(getpid(), config->cont_if, config->cont_ip, config->gateway) != 0) {
-            fprintf(stderr, "Failed to configure network interface\n");
-            return 1;
-        }
+    // Switch to a clone of the prepared mount tree
+    if (mounts_enter_template(config->template_path, config->read_only, config->volumes) != 0) {
+        fprintf(stderr, "Failed to set up container mounts\n");
+        return 1;
+    }
+
+    // Report in, then wait for the host side (cgroup, network) to finish.
+    // EOF on the go pipe means the parent gave up.
+    char byte = 1;
+    if (write(config->child_ready[1], &byte, 1) != 1) {
+        return 1;
+    }
+    close(config->child_ready[1]);
+    if (read(config->child_go[0], &byte, 1) != 1) {
+        return 1;
     }
+    close(config->child_go[0]);
 
-    // Change root filesystem
-    if (chroot(config->rootfs) != 0) {
-        perror("chroot failed");
+    // Hand the control channel's memfd over to the command
+    if (config->control && control_setup_child(config->control) != 0) {
         return 1;
     }
-    if (chdir("/") != 0) {
-        perror("chdir failed");
+
+    // KSM and THP settings survive exec and are inherited by every fork
+    if (memory_apply_policy(&config->memory) != 0) {
         return 1;
     }
 
-    // Execute the command
-    execlp(config->command, config->command, NULL);
-    perror("execlp failed");
+    // Execute the command. The environment was built before clone: we are
+    // a copy of a multithreaded process and must not allocate.
+    char *const args[] = { config->command, NULL };
+    execvpe(config->command, args, config->child_env ? config->child_env : environ);
+    perror("execvpe failed");
     return 1;
 }
 
+// Shared state for the launch pipeline steps
+struct Launch {
+    struct ContainerConfig *config;
+    ContainerState *state;
+    CgroupLimits limits;
+    pid_t pid;
+};
+
+static int step_template(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    // Build (or reuse) the mount tree template for this rootfs/volume set
+    MountConfig mount_config = { .rootfs = config->rootfs, .volumes = config->volumes };
+    if (mounts_prepare_template(&mount_config, config->template_path,
+                                sizeof(config->template_path)) != 0) {
+        fprintf(stderr, "Failed to prepare mount template\n");
+        return -1;
+    }
+    return 0;
+}
+
+struct RootfsUsers {
+    const ContainerState *self;
+    int count;
+};
+
+static int count_rootfs_user(const ContainerState *st, void *arg) {
+    struct RootfsUsers *users = arg;
+    if (strcmp(st->id, users->self->id) != 0 && st->rootfs[0] &&
+        strcmp(st->rootfs, users->self->rootfs) == 0 && state_supervisor_alive(st)) {
+        users->count++;
+    }
+    return 0;
+}
+
+// Number of other live containers on self's rootfs (or image).
+static int count_rootfs_users(const ContainerState *self) {
+    struct RootfsUsers users = { .self = self, .count = 0 };
+    if (self->rootfs[0]) {
+        state_foreach(count_rootfs_user, &users);
+    }
+    return users.count;
+}
+
+static void *prewarm_thread(void *arg) {
+    struct ContainerConfig *config = arg;
+    // Best effort: only queues readahead, so failures never block the launch
+    PrewarmStats stats;
+    if (prewarm_apply(config->rootfs, config->prewarm_profile, &stats) == 0 && config->trace) {
+        fprintf(stderr, "prewarm: queued %llu KiB across %zu files\n",
+                stats.bytes / 1024, stats.files);
+    }
+    return NULL;
+}
+
+// Walking the profile takes as long as the launch itself on a big rootfs, and
+// pipeline_run waits for every step, so the readahead gets its own detached
+// thread instead. It only reads config, which outlives the container.
+static void start_prewarm(struct ContainerConfig *config) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    if (pthread_attr_init(&attr) != 0) {
+        return;
+    }
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, prewarm_thread, config) != 0) {
+        fprintf(stderr, "Warning: prewarm skipped\n");
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static int step_cgroup(void *arg) {
+    struct Launch *launch = arg;
+    if (cgroups_create(launch->state->cgroup) != 0) {
+        fprintf(stderr, "Failed to create cgroups\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_limits(void *arg) {
+    struct Launch *launch = arg;
+    if (cgroups_apply_limits(launch->state->cgroup, &launch->limits) != 0) {
+        fprintf(stderr, "Failed to apply cgroup limits\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_logs(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    // Capture stdout/stderr into per-container logs
+    config->logs = logs_create(config->id, &config->log);
+    if (!config->logs) {
+        fprintf(stderr, "Failed to set up log capture\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_channel(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    config->control = control_create(config->id, config->trace);
+    if (config->control) {
+        config->child_env = control_child_env(config->control);
+    }
+    if (!config->child_env) {
+        fprintf(stderr, "Failed to set up control channel\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_bridge(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    if (net_ensure_bridge(config->bridge_name) != 0) {
+        fprintf(stderr, "Failed to create bridge\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_veth(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    if (net_create_veth_pair(config->host_if, config->cont_if) != 0) {
+        fprintf(stderr, "Failed to create veth pair\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_bridge_attach(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    if (net_attach_to_bridge(config->host_if, config->bridge_name) != 0) {
+        fprintf(stderr, "Failed to attach interface to bridge\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_clone(void *arg) {
+    struct Launch *launch = arg;
+    struct ContainerConfig *config = launch->config;
+
+    if (pipe2(config->child_ready, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        config->child_ready[0] = -1;
+        return -1;
+    }
+    if (pipe2(config->child_go, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        close(config->child_ready[1]);
+        config->child_go[1] = -1;
+        return -1;
+    }
+
+    // Other pipeline threads may be inside stdio right now. Hold the stream
+    // locks across clone so the child never inherits them mid-update.
+    flockfile(stdout);
+    flockfile(stderr);
+    pid_t pid = clone(child_func, child_stack + STACK_SIZE,
+                      CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | CLONE_NEWNET | SIGCHLD,
+                      config);
+    funlockfile(stderr);
+    funlockfile(stdout);
+
+    close(config->child_ready[1]);
+    close(config->child_go[0]);
+    if (pid == -1) {
+        perror("clone failed");
+        return -1;
+    }
+    logs_parent_after_clone(config->logs);
+
+    launch->pid = pid;
+    launch->state->pid = pid;
+    if (state_save(launch->state) != 0) {
+        fprintf(stderr, "Failed to record container pid\n");
+    }
+    return 0;
+}
+
+static int step_child_setup(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    char byte;
+    ssize_t n = read(config->child_ready[0], &byte, 1);
+    close(config->child_ready[0]);
+    config->child_ready[0] = -1;
+    if (n != 1) {
+        fprintf(stderr, "Container failed during setup\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_cgroup_attach(void *arg) {
+    struct Launch *launch = arg;
+    // Limits, stats and teardown all act on the cgroup; a container outside
+    // it would outlive its own teardown
+    if (cgroups_attach_pid(launch->state->cgroup, launch->pid) != 0) {
+        fprintf(stderr, "Failed to attach PID to cgroups\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_veth_move(void *arg) {
+    struct Launch *launch = arg;
+    if (net_move_if_to_ns(launch->config->cont_if, launch->pid,
+                          launch->config->cont_if_name) != 0) {
+        fprintf(stderr, "Failed to move interface to namespace\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_net_config(void *arg) {
+    struct Launch *launch = arg;
+    struct ContainerConfig *config = launch->config;
+    if (net_configure_if_in_ns(launch->pid, config->cont_if_name, config->cont_ip,
+                               config->gateway) != 0) {
+        fprintf(stderr, "Failed to configure network interface\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int step_release(void *arg) {
+    struct ContainerConfig *config = ((struct Launch *)arg)->config;
+    char byte = 1;
+    // Channel times count from here, not from when the poller gets going
+    control_mark_start(config->control);
+    ssize_t n = write(config->child_go[1], &byte, 1);
+    close(config->child_go[1]);
+    config->child_go[1] = -1;
+    if (n != 1) {
+        perror("release container");
+        return -1;
+    }
+    return 0;
+}
+
+// Launch dependency graph. Independent host work runs on the worker pool
+// while the child sets up its hostname and mounts:
+//
+//   template --.
+//   logs ------+-- clone* --+-- child-setup --------------------.
+//                           |                                   |
+//   cgroup -- limits -------+-- cgroup-attach ------------------+-- release
+//                           |                                   |
+//   veth --+----------------+-- veth-move -- net-config --------+
+//          |                                                    |
+//   bridge +-- bridge-attach -----------------------------------'
+//
+//   prewarm (page-cache readahead from a recorded profile) runs on a detached
+//   thread outside the graph; nothing waits on it
+//
+// (* on the main thread; networking steps only with --ip)
+// The only parent/child sync points are child-setup (child -> parent) and
+// release (parent -> child, right before exec).
+static int run_launch(struct Launch *launch) {
+    struct ContainerConfig *config = launch->config;
+    Pipeline *p = pipeline_create(4);
+    if (!p) {
+        return -1;
+    }
+    config->child_ready[0] = config->child_go[1] = -1;
+
+    int template = pipeline_add(p, "template", step_template, launch, 0);
+    int logs = pipeline_add(p, "logs", step_logs, launch, 0);
+    int cgroup = pipeline_add(p, "cgroup", step_cgroup, launch, 0);
+    int limits = pipeline_add(p, "limits", step_limits, launch, 0);
+    int clone_step = pipeline_add(p, "clone", step_clone, launch, PIPELINE_MAIN_THREAD);
+    int child = pipeline_add(p, "child-setup", step_child_setup, launch, 0);
+    int attach = pipeline_add(p, "cgroup-attach", step_cgroup_attach, launch, 0);
+    int release = pipeline_add(p, "release", step_release, launch, 0);
+
+    pipeline_depend(p, limits, cgroup);
+    pipeline_depend(p, clone_step, template);
+    pipeline_depend(p, clone_step, logs);
+    pipeline_depend(p, child, clone_step);
+    pipeline_depend(p, attach, clone_step);
+    pipeline_depend(p, attach, limits);
+    pipeline_depend(p, release, child);
+    pipeline_depend(p, release, attach);
+
+    if (!config->no_prewarm && !config->record_window_ms &&
+        access(config->prewarm_profile, R_OK) == 0) {
+        start_prewarm(config);
+    }
+
+    if (config->channel) {
+        int channel = pipeline_add(p, "channel", step_channel, launch, 0);
+        pipeline_depend(p, clone_step, channel);
+    }
+
+    if (config->cont_ip) {
+        int bridge = pipeline_add(p, "bridge", step_bridge, launch, 0);
+        int veth = pipeline_add(p, "veth", step_veth, launch, 0);
+        int bridge_attach = pipeline_add(p, "bridge-attach", step_bridge_attach, launch, 0);
+        int move = pipeline_add(p, "veth-move", step_veth_move, launch, 0);
+        int net = pipeline_add(p, "net-config", step_net_config, launch, 0);
+
+        pipeline_depend(p, bridge_attach, bridge);
+        pipeline_depend(p, bridge_attach, veth);
+        pipeline_depend(p, move, veth);
+        pipeline_depend(p, move, clone_step);
+        pipeline_depend(p, net, move);
+        pipeline_depend(p, release, net);
+        pipeline_depend(p, release, bridge_attach);
+    }
+
+    int ret = pipeline_run(p);
+    if (config->trace) {
+        pipeline_trace(p, stderr);
+    }
+    // If release never ran, closing our end makes the waiting child exit
+    if (config->child_go[1] >= 0) {
+        close(config->child_go[1]);
+    }
+    if (config->child_ready[0] >= 0) {
+        close(config->child_ready[0]);
+    }
+    pipeline_destroy(p);
+    return ret;
+}
+
+// nsrun logs [-f] [-t] <id>
+static int cmd_logs(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"follow", no_argument, 0, 'f'},
+        {"timestamps", no_argument, 0, 't'},
+        {0, 0, 0, 0}
+    };
+    int follow = 0;
+    int timestamps = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "ft", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                follow = 1;
+                break;
+            case 't':
+                timestamps = 1;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: nsrun logs [--follow] [--timestamps] <id>\n");
+        return 1;
+    }
+    return logs_print(argv[optind], follow, timestamps) == 0 ? 0 : 1;
+}
+
+// nsrun stats [--perf|--ksm] [--interval <seconds>] [--count <n>] [--json] <id>
+static int cmd_stats(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"perf", no_argument, 0, 'p'},
+        {"ksm", no_argument, 0, 'k'},
+        {"interval", required_argument, 0, 'i'},
+        {"count", required_argument, 0, 'n'},
+        {"json", no_argument, 0, 'j'},
+        {0, 0, 0, 0}
+    };
+    StatsOptions opts = { .perf = 0, .ksm = 0, .interval_ms = 1000, .count = 0, .json = 0 };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "pki:n:j", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                opts.perf = 1;
+                break;
+            case 'k':
+                opts.ksm = 1;
+                break;
+            case 'i':
+                opts.interval_ms = (int)(strtod(optarg, NULL) * 1000);
+                break;
+            case 'n':
+                opts.count = atoi(optarg);
+                break;
+            case 'j':
+                opts.json = 1;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind != argc - 1 || opts.interval_ms <= 0 || opts.count < 0 ||
+        (opts.perf && opts.ksm)) {
+        fprintf(stderr, "Usage: nsrun stats [--perf|--ksm] [--interval <seconds>] [--count <n>] [--json] <id>\n");
+        return 1;
+    }
+    return stats_print(argv[optind], &opts) == 0 ? 0 : 1;
+}
+
+// Fork a background supervisor. The foreground process waits until the
+// container is running (or setup failed), prints its id and exits.
+// Returns the write end of the readiness pipe in the supervisor.
+static int detach_supervisor(void) {
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid > 0) {
+        close(ready[1]);
+        char ok = 0;
+        if (read(ready[0], &ok, 1) != 1 || ok != 1) {
+            exit(1);
+        }
+        printf("nsrun-%d\n", pid);
+        exit(0);
+    }
+
+    close(ready[0]);
+    setsid();
+    int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null >= 0) {
+        dup2(null, STDIN_FILENO);
+        close(null);
+    }
+    return ready[1];
+}
+
+// Drain container output until it exits and the pipes are empty.
+// Returns the container's exit code.
+static int supervise(pid_t pid, LogCapture *logs) {
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    int status = 0;
+    int exited = 0;
+
+    while (!exited || !logs_done(logs)) {
+        struct pollfd fds[LOGS_MAX_POLLFDS + 1];
+        int n = logs_poll_fds(logs, fds, LOGS_MAX_POLLFDS);
+        int wait_idx = -1;
+        if (!exited && pidfd >= 0) {
+            wait_idx = n;
+            fds[n].fd = pidfd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            n++;
+        }
+
+        // Without a pidfd (pre-5.3 kernels) fall back to periodic waitpid
+        if (poll(fds, (nfds_t)n, pidfd >= 0 || exited ? -1 : 100) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        if (logs_handle(logs, fds, wait_idx >= 0 ? wait_idx : n) != 0) {
+            break;
+        }
+        if (!exited && (pidfd < 0 || fds[wait_idx].revents)) {
+            exited = waitpid(pid, &status, WNOHANG) == pid;
+        }
+    }
+
+    if (!exited) {
+        waitpid(pid, &status, 0);
+    }
+    if (pidfd >= 0) {
+        close(pidfd);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
 int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "logs") == 0) {
+        return cmd_logs(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "exec") == 0) {
+        // nsrun exec [--trace] <id> [--] <command> [args...]
+        int trace = argc > 2 && strcmp(argv[2], "--trace") == 0;
+        int idx = 2 + trace;
+        int cmd = argc > idx + 1 && strcmp(argv[idx + 1], "--") == 0 ? idx + 2 : idx + 1;
+        if (cmd >= argc) {
+            fprintf(stderr, "Usage: nsrun exec [--trace] <id> <command> [args...]\n");
+            return 1;
+        }
+        int ret = exec_run(argv[idx], argv + cmd, trace);
+        return ret < 0 ? 1 : ret;
+    }
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        return cmd_stats(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "reap") == 0) {
+        printf("Reaped %d container(s)\n", teardown_reap(NULL));
+        printf("Dropped %d unused template(s)\n", mounts_drop_unused_templates());
+        return 0;
+    }
+
     // Initialize configuration with defaults
     struct ContainerConfig config = {
         .rootfs = "./rootfs",
@@ -146,17 +899,29 @@ int main(int argc, char *argv[]) {
         .memory_limit_bytes = 0, // unlimited
         .cpu_quota_us = 0,       // unlimited
         .cpu_period_us = 0,      // unlimited
+        .cpu_uclamp_min = -1,    // kernel default
+        .cpu_uclamp_max = -1,    // kernel default
         .pids_max = 0,           // unlimited
         .bridge_name = "nsrun-br0",
-        .host_if = "veth-host",
-        .cont_if = "veth-cont",
+        .cont_if_name = "veth-cont",
         .cont_ip = "10.0.0.2/24",
-        .gateway = "10.0.0.1"
+        .gateway = "10.0.0.1",
+        .log = {
+            .max_size = 10ULL * 1024 * 1024,
+            .max_files = 3,
+            .buffer_size = 1024 * 1024,
+            .policy = LOG_POLICY_DROP,
+            .console = 1
+        }
     };
 
     // Parse command line arguments
     if (parse_args(argc, argv, &config) != 0) {
-        fprintf(stderr, "Usage: %s --rootfs <path> [--hostname <name>] [--memory <bytes|M|G>] [--cpu <fraction>] [--pids <max>] [--bridge <name>] [--ip <cidr>] [--gateway <ip>] <command>\n", argv[0]);
+        fprintf(stderr, "Usage: %s --rootfs <path> [--hostname <name>] [--memory <bytes|M|G>] [--cpu <fraction>] [--cpu-period <us>] [--cpu-burst <us>] [--cpu-weight <1-10000>] [--cpu-uclamp-min <pct>] [--cpu-uclamp-max <pct>] [--cpu-idle] [--pids <max>] [--ksm] [--thp inherit|never|madvise] [--channel] [--bridge <name>] [--ip <cidr>] [--gateway <ip>] [--volume <host:container[:ro]>] [--read-only] [--detach] [--log-max-size <bytes>] [--log-max-files <n>] [--log-buffer <bytes>] [--log-policy drop|block] [--trace] [--record-profile[=<seconds>]] [--no-prewarm] <command>\n"
+                        "       %s logs [--follow] [--timestamps] <id>\n"
+                        "       %s exec [--trace] <id> <command> [args...]\n"
+                        "       %s stats [--perf|--ksm] [--interval <seconds>] [--count <n>] [--json] <id>\n"
+                        "       %s reap\n", argv[0], argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
@@ -166,6 +931,29 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (config.memory.ksm && !memory_ksm_supported()) {
+        fprintf(stderr, "Warning: KSM merging is lost on exec before Linux 6.7; --ksm ignored\n");
+        config.memory.ksm = 0;
+    }
+    // Mergeable pages only get scanned while ksmd runs; that is host policy
+    if (config.memory.ksm && !memory_ksm_running()) {
+        fprintf(stderr, "Warning: ksmd is not running (/sys/kernel/mm/ksm/run); "
+                        "--ksm has no effect until it is enabled\n");
+    }
+
+    // Detached: hand the terminal back once the container is up
+    int ready_fd = -1;
+    if (config.detach) {
+        ready_fd = detach_supervisor();
+        config.log.console = 0;
+    }
+    snprintf(config.id, sizeof(config.id), "nsrun-%d", getpid());
+
+    // Host-side names follow the id: a background teardown of the previous
+    // container must never find and delete this one's interface
+    snprintf(config.host_if, sizeof(config.host_if), "veth-h%d", (int)getpid());
+    snprintf(config.cont_if, sizeof(config.cont_if), "veth-c%d", (int)getpid());
+
     // Create namespace
     Namespace *ns = create_namespace("container-ns");
     if (!ns) {
@@ -184,79 +972,125 @@ int main(int argc, char *argv[]) {
 
     // Create cgroups and apply limits
     char cgroup_path[256];
-    snprintf(cgroup_path, sizeof(cgroup_path), "/sys/fs/cgroup/nsrun-%d", getpid());
+    snprintf(cgroup_path, sizeof(cgroup_path), "%s/%s", NSRUN_CGROUP_ROOT, config.id);
 
-    if (cgroups_create(cgroup_path) != 0) {
-        fprintf(stderr, "Failed to create cgroups\n");
-        destroy_namespace(ns);
-        return 1;
+    // Record the container before creating anything a crash could leak.
+    // A stale record under our id (pid reuse) is cleaned up first.
+    ContainerState state = { .supervisor = getpid(), .pid = 0 };
+    snprintf(state.id, sizeof(state.id), "%s", config.id);
+    snprintf(state.cgroup, sizeof(state.cgroup), "%s", cgroup_path);
+    if (config.cont_ip) {
+        snprintf(state.host_if, sizeof(state.host_if), "%s", config.host_if);
     }
+    state.supervisor_start = state_process_start(state.supervisor);
+    state.ksm = config.memory.ksm;
+    state.thp = (int)config.memory.thp;
 
-    // Apply resource limits if specified
-    CgroupLimits limits = {
-        .memory_limit_bytes = config.memory_limit_bytes,
-        .cpu_quota_us = config.cpu_quota_us,
-        .cpu_period_us = config.cpu_period_us,
-        .pids_max = config.pids_max
-    };
+    // Image rootfs: the record names the shared mount so teardown drops
+    // this container's reference
+    const char *image = NULL;
+    if (mounts_is_image(config.rootfs)) {
+        image = config.rootfs;
+        if (mounts_image_path(image, state.image, sizeof(state.image)) != 0) {
+            fprintf(stderr, "Invalid rootfs image %s\n", image);
+            destroy_namespace(ns);
+            return 1;
+        }
+        snprintf(state.rootfs, sizeof(state.rootfs), "%s", state.image);
+    } else {
+        char resolved[PATH_MAX];
+        // Too long to record: left empty, it just goes unmatched
+        if (realpath(config.rootfs, resolved) &&
+            (size_t)snprintf(state.rootfs, sizeof(state.rootfs), "%s", resolved) >=
+                sizeof(state.rootfs)) {
+            state.rootfs[0] = '\0';
+        }
+    }
 
-    if (cgroups_apply_limits(cgroup_path, &limits) != 0) {
-        fprintf(stderr, "Failed to apply cgroup limits\n");
-        cgroups_destroy(cgroup_path);
+    ContainerState stale;
+    if (state_load(config.id, &stale) == 0) {
+        teardown_run(&stale);
+    }
+    if (state_save(&state) != 0) {
+        fprintf(stderr, "Failed to record container state\n");
         destroy_namespace(ns);
         return 1;
     }
+    // Leftovers from crashed runs are cleaned up off the launch path
+    teardown_reap_async(config.id);
 
-    // Setup networking if IP is specified
-    if (config.cont_ip) {
-        // Ensure bridge exists
-        if (net_ensure_bridge(config.bridge_name) != 0) {
-            fprintf(stderr, "Failed to create bridge\n");
-            cgroups_destroy(cgroup_path);
-            destroy_namespace(ns);
-            return 1;
-        }
-
-        // Create veth pair
-        if (net_create_veth_pair(config.host_if, config.cont_if) != 0) {
-            fprintf(stderr, "Failed to create veth pair\n");
-            cgroups_destroy(cgroup_path);
+    // Every container of an image shares one read-only loop mount; only the
+    // first one pays for attaching and mounting it
+    if (image) {
+        if (mounts_image_acquire(image, state.image, config.id) != 0) {
+            fprintf(stderr, "Failed to mount rootfs image %s\n", image);
+            teardown_run(&state);
             destroy_namespace(ns);
             return 1;
         }
+        config.rootfs = state.image;
+    }
 
-        // Attach host interface to bridge
-        if (net_attach_to_bridge(config.host_if, config.bridge_name) != 0) {
-            fprintf(stderr, "Failed to attach interface to bridge\n");
-            cgroups_destroy(cgroup_path);
-            destroy_namespace(ns);
-            return 1;
-        }
+    // Recording: start from a cold cache so the profile only holds what
+    // this container reads. Image profiles live next to the image file.
+    if (prewarm_profile_path(image ? image : config.rootfs, config.prewarm_profile,
+                             sizeof(config.prewarm_profile)) != 0) {
+        config.prewarm_profile[0] = '\0';
+        config.record_window_ms = 0;
+    }
+    // Eviction is not ours alone: it also empties the cache under every
+    // other container on this rootfs, and their reads land in the profile
+    int sharing = config.record_window_ms > 0 ? count_rootfs_users(&state) : 0;
+    if (sharing > 0) {
+        fprintf(stderr, "Warning: %d other running container(s) use %s; recording evicts "
+                        "their page cache and may profile their reads too\n",
+                sharing, image ? image : config.rootfs);
+    }
+    if (config.record_window_ms > 0 && prewarm_evict(config.rootfs) != 0) {
+        fprintf(stderr, "Failed to evict rootfs pages; profile may include unrelated pages\n");
     }
 
-    // Clone child process with all namespaces
-    pid_t pid = clone(child_func, child_stack + STACK_SIZE,
-                     CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | CLONE_NEWNET,
-                     &config);
-    if (pid == -1) {
-        perror("clone failed");
-        cgroups_destroy(cgroup_path);
+    // Host-side setup and the child's own setup run concurrently; see
+    // run_launch for the dependency graph
+    struct Launch launch = {
+        .config = &config,
+        .state = &state,
+        .limits = {
+            .memory_limit_bytes = config.memory_limit_bytes,
+            .cpu_quota_us = config.cpu_quota_us,
+            .cpu_period_us = config.cpu_period_us,
+            .cpu_burst_us = config.cpu_burst_us,
+            .cpu_weight = config.cpu_weight,
+            .cpu_uclamp_min = config.cpu_uclamp_min,
+            .cpu_uclamp_max = config.cpu_uclamp_max,
+            .cpu_idle = config.cpu_idle,
+            .pids_max = config.pids_max
+        },
+        .pid = -1
+    };
+    if (run_launch(&launch) != 0) {
+        fprintf(stderr, "Failed to launch container\n");
+        if (launch.pid > 0) {
+            kill(launch.pid, SIGKILL);
+            waitpid(launch.pid, NULL, 0);
+        }
+        logs_finish(config.logs, -1);
+        control_finish(config.control);
+        teardown_run(&state);
         destroy_namespace(ns);
         return 1;
     }
+    pid_t pid = launch.pid;
 
-    // In parent: attach child PID to cgroups
-    if (cgroups_attach_pid(cgroup_path, pid) != 0) {
-        fprintf(stderr, "Failed to attach PID to cgroups\n");
-        // Continue anyway, child might still work
+    // The command is running; from here on the workload may report in
+    if (config.control && control_start(config.control) != 0) {
+        fprintf(stderr, "Warning: control channel messages will not be read\n");
     }
 
-    // Move network interface to child namespace if networking is enabled
-    if (config.cont_ip) {
-        if (net_move_if_to_ns(config.cont_if, pid) != 0) {
-            fprintf(stderr, "Failed to move interface to namespace\n");
-            // Continue anyway
-        }
+    PrewarmRecorder *recorder = NULL;
+    if (config.record_window_ms > 0) {
+        recorder = prewarm_record_start(config.rootfs, config.prewarm_profile,
+                                        config.record_window_ms);
     }
 
     // Store PID in namespace
@@ -266,7 +1100,7 @@ int main(int argc, char *argv[]) {
     Container *container = create_container();
     if (!container) {
         fprintf(stderr, "Failed to create container\n");
-        cgroups_destroy(cgroup_path);
+        teardown_run(&state);
         destroy_namespace(ns);
         return 1;
     }
@@ -274,19 +1108,45 @@ int main(int argc, char *argv[]) {
     if (add_namespace(container, ns) != 0) {
         fprintf(stderr, "Failed to add namespace to container\n");
         destroy_container(container);
-        cgroups_destroy(cgroup_path);
+        teardown_run(&state);
         return 1;
     }
 
-    // Wait for child process
-    int status;
-    waitpid(pid, &status, 0);
+    // Container is up: release the foreground process when detached
+    if (ready_fd >= 0) {
+        char ok = 1;
+        if (write(ready_fd, &ok, 1) != 1) {
+            perror("write ready");
+        }
+        close(ready_fd);
+        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+    }
+
+    // Drain output until the container exits
+    int exit_code = supervise(pid, config.logs);
+    logs_finish(config.logs, exit_code);
+    control_finish(config.control);
 
-    // Cleanup
+    if (recorder) {
+        PrewarmStats stats;
+        if (prewarm_record_finish(recorder, &stats) == 0) {
+            fprintf(stderr, "Recorded prewarm profile %s: %llu KiB across %zu files\n",
+                    config.prewarm_profile, stats.bytes / 1024, stats.files);
+        }
+    }
+
+    // Cleanup; killing stragglers and removing the cgroup happens in the
+    // background so the exit code is reported right away
     destroy_container(container);
-    cgroups_destroy(cgroup_path);
+    teardown_async(&state);
+    mounts_free_volumes(config.volumes);
 
-    return WEXITSTATUS(status);
+    return exit_code;
 }
 
 #else // Not Linux
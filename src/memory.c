@@ -0,0 +1,118 @@
+#include "memory.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+// Newer than many installed kernel headers
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+#ifndef PR_THP_DISABLE_EXCEPT_ADVISED
+#define PR_THP_DISABLE_EXCEPT_ADVISED (1 << 1)
+#endif
+
+#define KSM_RUN "/sys/kernel/mm/ksm/run"
+
+int memory_parse_thp(const char *name, ThpMode *mode) {
+    if (!name || !mode) {
+        return -1;
+    }
+    if (strcmp(name, "inherit") == 0) {
+        *mode = THP_INHERIT;
+    } else if (strcmp(name, "never") == 0) {
+        *mode = THP_NEVER;
+    } else if (strcmp(name, "madvise") == 0) {
+        *mode = THP_MADVISE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int memory_apply_policy(const MemoryPolicy *policy) {
+    if (!policy) {
+        return -1;
+    }
+
+    // Every anonymous VMA is KSM-mergeable, and, from Linux 6.7, stays so
+    // after exec (memory_ksm_supported)
+    if (policy->ksm && prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) != 0) {
+        if (errno != EINVAL) {
+            perror("prctl PR_SET_MEMORY_MERGE");
+            return -1;
+        }
+        fprintf(stderr, "Warning: kernel does not support KSM for whole processes; --ksm ignored\n");
+    }
+
+    if (policy->thp == THP_NEVER && prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) != 0) {
+        perror("prctl PR_SET_THP_DISABLE");
+        return -1;
+    }
+    if (policy->thp == THP_MADVISE &&
+        prctl(PR_SET_THP_DISABLE, 1, PR_THP_DISABLE_EXCEPT_ADVISED, 0, 0) != 0) {
+        if (errno != EINVAL) {
+            perror("prctl PR_SET_THP_DISABLE");
+            return -1;
+        }
+        fprintf(stderr, "Warning: kernel does not support madvise-only THP per process; "
+                        "using the host default\n");
+    }
+    return 0;
+}
+
+int memory_ksm_supported(void) {
+    // 6.4 and 6.5/6.6 have the prctl, but exec drops it with the old mm,
+    // and nothing in the process can read it back from the other side
+    struct utsname u;
+    int major = 0;
+    int minor = 0;
+    if (uname(&u) != 0 || sscanf(u.release, "%d.%d", &major, &minor) != 2) {
+        return 0;
+    }
+    return major > 6 || (major == 6 && minor >= 7);
+}
+
+int memory_ksm_running(void) {
+    FILE *f = fopen(KSM_RUN, "re");
+    if (!f) {
+        return 0;
+    }
+    int run = 0;
+    if (fscanf(f, "%d", &run) != 1) {
+        run = 0;
+    }
+    fclose(f);
+    return run == 1;
+}
+
+int memory_read_ksm(pid_t pid, KsmStats *stats) {
+    if (!stats) {
+        return -1;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/ksm_stat", (int)pid);
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -1;
+    }
+
+    char key[64];
+    char value[32];
+    while (fscanf(f, "%63s %31s", key, value) == 2) {
+        if (strcmp(key, "ksm_merging_pages") == 0) {
+            stats->merging_pages += strtoull(value, NULL, 10);
+        } else if (strcmp(key, "ksm_zero_pages") == 0) {
+            stats->zero_pages += strtoull(value, NULL, 10);
+        } else if (strcmp(key, "ksm_process_profit") == 0) {
+            stats->profit += strtoll(value, NULL, 10);
+        } else if (strcmp(key, "ksm_merge_any:") == 0) {
+            stats->merge_any += strcmp(value, "yes") == 0;
+        }
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// memory.h - Per-container memory policy (KSM, transparent hugepages) and KSM stats
+
+#ifndef NSRUN_MEMORY_H
+#define NSRUN_MEMORY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+// Transparent hugepage mode for the container's processes.
+typedef enum ThpMode {
+	THP_INHERIT,  // Whatever the host's transparent_hugepage/enabled says
+	THP_NEVER,    // No THP at all (PR_SET_THP_DISABLE)
+	THP_MADVISE   // THP only for MADV_HUGEPAGE regions (Linux 6.18+)
+} ThpMode;
+
+typedef struct MemoryPolicy {
+	int ksm;       // Non-zero: make all anonymous memory mergeable by KSM
+	ThpMode thp;
+} MemoryPolicy;
+
+// KSM counters for one or more processes (/proc/<pid>/ksm_stat).
+typedef struct KsmStats {
+	unsigned long long merging_pages;  // Pages of ours currently deduplicated
+	unsigned long long zero_pages;     // Empty pages mapped to the shared zero page
+	long long profit;                  // Bytes saved minus KSM's metadata overhead
+	int merge_any;                     // Processes with PR_SET_MEMORY_MERGE in effect
+} KsmStats;
+
+// Parse "inherit", "never" or "madvise". Returns 0 on success, -1 if unknown.
+int memory_parse_thp(const char *name, ThpMode *mode);
+
+// Child side, before exec: apply the policy to the calling process. Both
+// settings are inherited across fork and kept across exec (KSM only from
+// Linux 6.7, see memory_ksm_supported). Settings the
+// kernel does not support are reported and skipped. Returns 0 on success,
+// -1 on error.
+int memory_apply_policy(const MemoryPolicy *policy);
+
+// Non-zero if the kernel keeps PR_SET_MEMORY_MERGE across exec (Linux 6.7+);
+// before that the setting is lost when the command starts.
+int memory_ksm_supported(void);
+
+// Non-zero if ksmd is running; merging only happens while it is.
+int memory_ksm_running(void);
+
+// Add pid's KSM counters to stats. Returns 0 on success, -1 if unavailable.
+int memory_read_ksm(pid_t pid, KsmStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_MEMORY_H
@@ -0,0 +1,1012 @@
+#include "mounts.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/loop.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Older glibc releases ship neither wrappers nor constants for the new mount
+// API, so talk to the kernel directly and fill in whatever is missing.
+#ifndef SYS_open_tree
+#define SYS_open_tree 428
+#endif
+#ifndef SYS_move_mount
+#define SYS_move_mount 429
+#endif
+#ifndef SYS_fsopen
+#define SYS_fsopen 430
+#endif
+#ifndef SYS_fsconfig
+#define SYS_fsconfig 431
+#endif
+#ifndef SYS_fsmount
+#define SYS_fsmount 432
+#endif
+#ifndef SYS_mount_setattr
+#define SYS_mount_setattr 442
+#endif
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE 1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC O_CLOEXEC
+#endif
+#ifndef AT_RECURSIVE
+#define AT_RECURSIVE 0x8000
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+#ifndef MOVE_MOUNT_T_EMPTY_PATH
+#define MOVE_MOUNT_T_EMPTY_PATH 0x00000040
+#endif
+#ifndef RESOLVE_NO_MAGICLINKS
+#define RESOLVE_NO_MAGICLINKS 0x02
+#endif
+#ifndef RESOLVE_IN_ROOT
+#define RESOLVE_IN_ROOT 0x10
+#endif
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC 0x00000001
+#endif
+#ifndef FSMOUNT_CLOEXEC
+#define FSMOUNT_CLOEXEC 0x00000001
+#endif
+#ifndef FSCONFIG_SET_FLAG
+#define FSCONFIG_SET_FLAG 0
+#endif
+#ifndef FSCONFIG_SET_STRING
+#define FSCONFIG_SET_STRING 1
+#endif
+#ifndef FSCONFIG_CMD_CREATE
+#define FSCONFIG_CMD_CREATE 6
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+#ifndef MOUNT_ATTR_NOSUID
+#define MOUNT_ATTR_NOSUID 0x00000002
+#endif
+#ifndef MOUNT_ATTR_NODEV
+#define MOUNT_ATTR_NODEV 0x00000004
+#endif
+#ifndef MOUNT_ATTR_NOEXEC
+#define MOUNT_ATTR_NOEXEC 0x00000008
+#endif
+
+// Same layout as the kernel's struct mount_attr (MOUNT_ATTR_SIZE_VER0).
+struct nsrun_mount_attr {
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+
+// Same layout as the kernel's struct open_how (OPEN_HOW_SIZE_VER0).
+struct nsrun_open_how {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+
+#ifndef LOOP_CONFIGURE
+#define LOOP_CONFIGURE 0x4C0A
+#endif
+
+// Same layout as the kernel's struct loop_config (Linux 5.8+).
+struct nsrun_loop_config {
+    uint32_t fd;
+    uint32_t block_size;
+    struct loop_info64 info;
+    uint64_t reserved[8];
+};
+
+// Device nodes bind-mounted from the host into the template's /dev.
+static const char *const dev_nodes[] = {
+    "null", "zero", "full", "random", "urandom", "tty", NULL
+};
+
+static int sys_open_tree(int dfd, const char *path, unsigned int flags) {
+    return (int)syscall(SYS_open_tree, dfd, path, flags);
+}
+
+static int sys_move_mount(int from_dfd, const char *from_path,
+                          int to_dfd, const char *to_path, unsigned int flags) {
+    return (int)syscall(SYS_move_mount, from_dfd, from_path, to_dfd, to_path, flags);
+}
+
+static int sys_fsopen(const char *fs_name, unsigned int flags) {
+    return (int)syscall(SYS_fsopen, fs_name, flags);
+}
+
+static int sys_fsconfig(int fd, unsigned int cmd, const char *key,
+                        const void *value, int aux) {
+    return (int)syscall(SYS_fsconfig, fd, cmd, key, value, aux);
+}
+
+static int sys_fsmount(int fd, unsigned int flags, unsigned int attr_flags) {
+    return (int)syscall(SYS_fsmount, fd, flags, attr_flags);
+}
+
+static int sys_mount_setattr(int dfd, const char *path, unsigned int flags,
+                             struct nsrun_mount_attr *attr) {
+    return (int)syscall(SYS_mount_setattr, dfd, path, flags, attr, sizeof(*attr));
+}
+
+// Open path below root as if root were "/": symlinks and ".." cannot leave it.
+static int open_in_root(int root, const char *path, int flags, mode_t mode) {
+    struct nsrun_open_how how = {
+        .flags = (uint64_t)(flags | O_CLOEXEC),
+        .mode = (flags & O_CREAT) ? mode : 0,
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+    return (int)syscall(SYS_openat2, root, path, &how, sizeof(how));
+}
+
+// Attach a detached mount (fd) at path. Closes fd.
+static int attach_at(int fd, const char *path) {
+    int ret = sys_move_mount(fd, "", AT_FDCWD, path, MOVE_MOUNT_F_EMPTY_PATH);
+    if (ret != 0) {
+        perror("move_mount");
+    }
+    close(fd);
+    return ret;
+}
+
+// Create a fresh filesystem instance with fsopen/fsmount and attach it.
+static int mount_fresh(const char *fstype, const char *mode, unsigned int attrs,
+                       const char *target) {
+    int fs = sys_fsopen(fstype, FSOPEN_CLOEXEC);
+    if (fs < 0) {
+        perror("fsopen");
+        return -1;
+    }
+    if (mode && sys_fsconfig(fs, FSCONFIG_SET_STRING, "mode", mode, 0) != 0) {
+        perror("fsconfig mode");
+        close(fs);
+        return -1;
+    }
+    if (sys_fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0) {
+        perror("fsconfig create");
+        close(fs);
+        return -1;
+    }
+    int mnt = sys_fsmount(fs, FSMOUNT_CLOEXEC, attrs);
+    close(fs);
+    if (mnt < 0) {
+        perror("fsmount");
+        return -1;
+    }
+    return attach_at(mnt, target);
+}
+
+// Minimal /dev: a tmpfs with a handful of host device nodes bound in.
+static int build_dev(const char *template_path) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dev", template_path);
+    if (mount_fresh("tmpfs", "755", MOUNT_ATTR_NOSUID | MOUNT_ATTR_NOEXEC, path) != 0) {
+        return -1;
+    }
+
+    for (const char *const *node = dev_nodes; *node; node++) {
+        char host[64];
+        snprintf(host, sizeof(host), "/dev/%s", *node);
+        snprintf(path, sizeof(path), "%s/dev/%s", template_path, *node);
+
+        int fd = open(path, O_CREAT | O_WRONLY | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            perror("create dev node target");
+            return -1;
+        }
+        close(fd);
+
+        int tree = sys_open_tree(AT_FDCWD, host, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+        if (tree < 0) {
+            perror("open_tree dev node");
+            return -1;
+        }
+        if (attach_at(tree, path) != 0) {
+            return -1;
+        }
+    }
+
+    static const char *const links[][2] = {
+        {"/proc/self/fd", "fd"},
+        {"/proc/self/fd/0", "stdin"},
+        {"/proc/self/fd/1", "stdout"},
+        {"/proc/self/fd/2", "stderr"},
+    };
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        snprintf(path, sizeof(path), "%s/dev/%s", template_path, links[i][1]);
+        if (symlink(links[i][0], path) != 0 && errno != EEXIST) {
+            perror("symlink /dev");
+            return -1;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/dev/shm", template_path);
+    if (mkdir(path, 01777) != 0 && errno != EEXIST) {
+        perror("mkdir /dev/shm");
+        return -1;
+    }
+    return 0;
+}
+
+// Open the volume target below the template root (an O_PATH fd), creating
+// it and any missing parents. The rootfs is not ours: every lookup stays
+// inside it, so a symlink such as /data -> /etc cannot aim the bind mount at
+// the host. Directories are created through the parent fd just resolved.
+static int open_volume_target(int root, const char *target, int dir) {
+    char path[PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s", target) >= sizeof(path)) {
+        return -1;
+    }
+
+    int parent = fcntl(root, F_DUPFD_CLOEXEC, 0);
+    char *name = path;
+    while (parent >= 0) {
+        while (*name == '/') {
+            name++;
+        }
+        char *slash = strchr(name, '/');
+        while (slash && slash[1] == '/') {
+            slash++;
+        }
+        int last = !slash || slash[1] == '\0';
+        if (*name == '\0') {
+            return parent; // The root itself
+        }
+        if (slash) {
+            *slash = '\0';
+        }
+
+        int want_dir = !last || dir;
+        int flags = O_PATH | (want_dir ? O_DIRECTORY : 0);
+        int fd = open_in_root(root, path, flags, 0);
+        if (fd < 0 && errno == ENOENT) {
+            if (want_dir) {
+                if (mkdirat(parent, name, 0755) == 0 || errno == EEXIST) {
+                    fd = open_in_root(root, path, flags, 0);
+                }
+            } else {
+                int created = open_in_root(root, path, O_CREAT | O_WRONLY, 0644);
+                if (created >= 0) {
+                    close(created);
+                    fd = open_in_root(root, path, flags, 0);
+                }
+            }
+        }
+        close(parent);
+        if (fd < 0 || last) {
+            return fd;
+        }
+        *slash = '/';
+        name = slash + 1;
+        parent = fd;
+    }
+    return -1;
+}
+
+static int bind_volume(const char *template_path, const MountVolume *vol) {
+    struct stat st;
+    if (stat(vol->source, &st) != 0) {
+        perror(vol->source);
+        return -1;
+    }
+
+    int root = open(template_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) {
+        perror("open template root");
+        return -1;
+    }
+    int target = open_volume_target(root, vol->target, S_ISDIR(st.st_mode));
+    close(root);
+    if (target < 0) {
+        fprintf(stderr, "Volume target %s: %s\n", vol->target, strerror(errno));
+        return -1;
+    }
+
+    int tree = sys_open_tree(AT_FDCWD, vol->source,
+                             OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree < 0) {
+        perror("open_tree volume");
+        close(target);
+        return -1;
+    }
+    if (vol->read_only) {
+        struct nsrun_mount_attr attr = { .attr_set = MOUNT_ATTR_RDONLY };
+        if (sys_mount_setattr(tree, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr) != 0) {
+            perror("mount_setattr volume");
+            close(tree);
+            close(target);
+            return -1;
+        }
+    }
+    int ret = sys_move_mount(tree, "", target, "",
+                             MOVE_MOUNT_F_EMPTY_PATH | MOVE_MOUNT_T_EMPTY_PATH);
+    if (ret != 0) {
+        perror("move_mount volume");
+    }
+    close(tree);
+    close(target);
+    return ret;
+}
+
+// Set and clear mount attributes on a volume (and anything below it) in the
+// tree at root.
+static int volume_setattr(int root, const MountVolume *vol, uint64_t set, uint64_t clr) {
+    int fd = open_in_root(root, vol->target, O_PATH, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Volume target %s: %s\n", vol->target, strerror(errno));
+        return -1;
+    }
+    struct nsrun_mount_attr attr = { .attr_set = set, .attr_clr = clr };
+    int ret = sys_mount_setattr(fd, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr);
+    if (ret != 0) {
+        perror("mount_setattr volume");
+    }
+    close(fd);
+    return ret;
+}
+
+// Build the full tree at template_path: rootfs bind, /dev, volumes.
+static int build_template(const MountConfig *cfg, const char *template_path) {
+    int tree = sys_open_tree(AT_FDCWD, cfg->rootfs,
+                             OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree < 0) {
+        perror("open_tree rootfs");
+        return -1;
+    }
+    if (attach_at(tree, template_path) != 0) {
+        return -1;
+    }
+
+    // proc and sys are per-container (they follow the pid/net namespace of
+    // whoever mounts them), but their mountpoints belong in the template.
+    static const char *const dirs[] = { "dev", "proc", "sys", NULL };
+    for (const char *const *d = dirs; *d; d++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", template_path, *d);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            perror("mkdir template dir");
+            return -1;
+        }
+    }
+
+    if (build_dev(template_path) != 0) {
+        return -1;
+    }
+    for (const MountVolume *vol = cfg->volumes; vol; vol = vol->next) {
+        if (bind_volume(template_path, vol) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static unsigned long long fnv_mix(unsigned long long h, const char *s) {
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    // Separator so "ab"+"c" and "a"+"bc" hash differently
+    return (h ^ 0xff) * 1099511628211ULL;
+}
+
+// FNV-1a over everything that shapes the tree, so equal configs share a template.
+static unsigned long long template_key(const char *rootfs, const MountVolume *volumes) {
+    unsigned long long h = fnv_mix(1469598103934665603ULL, rootfs);
+    for (const MountVolume *vol = volumes; vol; vol = vol->next) {
+        h = fnv_mix(h, vol->source);
+        h = fnv_mix(h, vol->target);
+        h = fnv_mix(h, vol->read_only ? "ro" : "rw");
+    }
+    return h;
+}
+
+MountVolume *mounts_parse_volume(const char *spec) {
+    if (!spec) {
+        return NULL;
+    }
+    char *copy = strdup(spec);
+    if (!copy) {
+        return NULL;
+    }
+
+    char *target = strchr(copy, ':');
+    if (!target || target == copy) {
+        free(copy);
+        return NULL;
+    }
+    *target++ = '\0';
+
+    int read_only = 0;
+    char *opts = strchr(target, ':');
+    if (opts) {
+        *opts++ = '\0';
+        if (strcmp(opts, "ro") == 0) {
+            read_only = 1;
+        } else if (strcmp(opts, "rw") != 0) {
+            free(copy);
+            return NULL;
+        }
+    }
+    if (target[0] != '/' || strstr(target, "..")) {
+        free(copy);
+        return NULL;
+    }
+
+    MountVolume *vol = calloc(1, sizeof(MountVolume));
+    if (!vol) {
+        free(copy);
+        return NULL;
+    }
+    vol->source = realpath(copy, NULL);
+    vol->target = strdup(target);
+    vol->read_only = read_only;
+    free(copy);
+    if (!vol->source || !vol->target) {
+        mounts_free_volumes(vol);
+        return NULL;
+    }
+    return vol;
+}
+
+void mounts_free_volumes(MountVolume *volumes) {
+    while (volumes) {
+        MountVolume *next = volumes->next;
+        free(volumes->source);
+        free(volumes->target);
+        free(volumes);
+        volumes = next;
+    }
+}
+
+// Open and flock path (op as for flock). Droppers unlink lock files while
+// holding them, so a lock taken on a file that has since been unlinked is
+// worthless: check it is still the one at path, else start over.
+// Returns the fd, or -1 (errno EWOULDBLOCK for a LOCK_NB that did not get it).
+static int lock_file(const char *path, int op) {
+    for (;;) {
+        int fd = open(path, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock(fd, op) != 0) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        struct stat held;
+        struct stat now;
+        if (fstat(fd, &held) == 0 && stat(path, &now) == 0 &&
+            held.st_dev == now.st_dev && held.st_ino == now.st_ino) {
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+// Detach template NSRUN_TEMPLATE_DIR/name and remove its directory. Unless
+// force is set, only if no process holds it in use. The sidecar files go
+// too when nobody holds them. Returns 1 if a mounted template was dropped.
+static int drop_template(const char *name, int force) {
+    char path[PATH_MAX];
+    char lock_path[PATH_MAX];
+    char ready_path[PATH_MAX];
+    char users_path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", NSRUN_TEMPLATE_DIR, name);
+    snprintf(lock_path, sizeof(lock_path), "%s/%s.lock", NSRUN_TEMPLATE_DIR, name);
+    snprintf(ready_path, sizeof(ready_path), "%s/%s.ready", NSRUN_TEMPLATE_DIR, name);
+    snprintf(users_path, sizeof(users_path), "%s/%s.users", NSRUN_TEMPLATE_DIR, name);
+
+    // A launch that got its users lock first keeps the template; one that
+    // comes later waits on the build lock and rebuilds
+    int lock = lock_file(lock_path, LOCK_EX);
+    if (lock < 0) {
+        return 0;
+    }
+    int users = lock_file(users_path, LOCK_EX | LOCK_NB);
+    if (users < 0 && !force) {
+        close(lock);
+        return 0;
+    }
+
+    unlink(ready_path);
+    int dropped = umount2(path, MNT_DETACH) == 0;
+    rmdir(path);
+    if (users >= 0) {
+        // Unlinked while held, so lock_file sends anyone waiting round again
+        unlink(users_path);
+        unlink(lock_path);
+        close(users);
+    }
+    close(lock);
+    return dropped;
+}
+
+int mounts_prepare_template(const MountConfig *cfg, char *path, size_t len) {
+    if (!cfg || !cfg->rootfs || !path) {
+        return -1;
+    }
+
+    char rootfs[PATH_MAX];
+    if (!realpath(cfg->rootfs, rootfs)) {
+        perror("realpath rootfs");
+        return -1;
+    }
+    MountConfig resolved = { .rootfs = rootfs, .volumes = cfg->volumes };
+
+    if (util_mkdir_p(NSRUN_TEMPLATE_DIR, 0700) != 0) {
+        perror("mkdir " NSRUN_TEMPLATE_DIR);
+        return -1;
+    }
+    if ((size_t)snprintf(path, len, "%s/%016llx", NSRUN_TEMPLATE_DIR,
+                         template_key(rootfs, cfg->volumes)) >= len) {
+        return -1;
+    }
+
+    // Serialize builders of the same template; the marker says it is complete.
+    char lock_path[PATH_MAX];
+    char ready_path[PATH_MAX];
+    char users_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    snprintf(ready_path, sizeof(ready_path), "%s.ready", path);
+    snprintf(users_path, sizeof(users_path), "%s.users", path);
+
+    // Shared for as long as this process lives (the fd is deliberately kept),
+    // so mounts_drop_unused_templates can tell the template is in use. Taken
+    // before the build lock, the opposite of the reaper's order, which only
+    // ever tries this one without waiting.
+    int users = lock_file(users_path, LOCK_SH);
+    if (users < 0) {
+        perror("lock template users");
+        return -1;
+    }
+    int lock = lock_file(lock_path, LOCK_EX);
+    if (lock < 0) {
+        perror("lock template");
+        close(users);
+        return -1;
+    }
+
+    int ret = 0;
+    if (access(ready_path, F_OK) != 0) {
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            perror("mkdir template");
+            ret = -1;
+        } else if (build_template(&resolved, path) != 0) {
+            // Drop whatever got attached so the next attempt starts clean
+            umount2(path, MNT_DETACH);
+            ret = -1;
+        } else {
+            int fd = open(ready_path, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                perror("open template marker");
+                ret = -1;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    close(lock);
+    if (ret != 0) {
+        close(users);
+    }
+    return ret;
+}
+
+int mounts_drop_unused_templates(void) {
+    DIR *d = opendir(NSRUN_TEMPLATE_DIR);
+    if (!d) {
+        return 0;
+    }
+    int dropped = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        // Every template has a build lock, including the leftovers of one
+        // whose directory went with an earlier drop
+        char name[NAME_MAX + 1];
+        size_t len = strlen(ent->d_name);
+        if (len <= 5 || strcmp(ent->d_name + len - 5, ".lock") != 0) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)(len - 5), ent->d_name);
+        dropped += drop_template(name, 0);
+    }
+    closedir(d);
+    return dropped;
+}
+
+int mounts_enter_template(const char *template_path, int read_only,
+                          const MountVolume *volumes) {
+    if (!template_path) {
+        return -1;
+    }
+
+    // Keep everything below from propagating back to the host
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) {
+        perror("make / private");
+        return -1;
+    }
+
+    int tree = sys_open_tree(AT_FDCWD, template_path,
+                             OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    if (tree < 0) {
+        perror("open_tree template");
+        return -1;
+    }
+
+    // One call covers every mount in the cloned tree
+    struct nsrun_mount_attr attr = {
+        .attr_set = MOUNT_ATTR_NOSUID | (read_only ? MOUNT_ATTR_RDONLY : 0),
+    };
+    if (sys_mount_setattr(tree, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr) != 0) {
+        perror("mount_setattr template");
+        close(tree);
+        return -1;
+    }
+
+    // Stack the clone on the template path; only this namespace sees it
+    if (attach_at(tree, template_path) != 0) {
+        return -1;
+    }
+
+    // --read-only covers the image, not what the user asked to share: rw
+    // volumes become writable again, then ro ones are re-marked in case one
+    // sits below a rw volume. Done once attached, as the kernel refuses
+    // mount_setattr on mounts below the root of a detached tree.
+    if (read_only && volumes) {
+        int root = open(template_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (root < 0) {
+            perror("open template root");
+            return -1;
+        }
+        for (const MountVolume *vol = volumes; vol; vol = vol->next) {
+            if (!vol->read_only && volume_setattr(root, vol, 0, MOUNT_ATTR_RDONLY) != 0) {
+                close(root);
+                return -1;
+            }
+        }
+        for (const MountVolume *vol = volumes; vol; vol = vol->next) {
+            if (vol->read_only && volume_setattr(root, vol, MOUNT_ATTR_RDONLY, 0) != 0) {
+                close(root);
+                return -1;
+            }
+        }
+        close(root);
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/proc", template_path);
+    if (mount_fresh("proc", NULL,
+                    MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV | MOUNT_ATTR_NOEXEC, path) != 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/sys", template_path);
+    if (mount_fresh("sysfs", NULL,
+                    MOUNT_ATTR_RDONLY | MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV |
+                    MOUNT_ATTR_NOEXEC, path) != 0) {
+        return -1;
+    }
+    // Writable even under --read-only, and not shared with other containers
+    // cloned from the same template's /dev
+    snprintf(path, sizeof(path), "%s/dev/shm", template_path);
+    if (mount_fresh("tmpfs", "1777", MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV, path) != 0) {
+        return -1;
+    }
+
+    if (chdir(template_path) != 0) {
+        perror("chdir template");
+        return -1;
+    }
+    // pivot_root(".", ".") stacks the old root under the new one; detach it
+    if (syscall(SYS_pivot_root, ".", ".") != 0) {
+        perror("pivot_root");
+        return -1;
+    }
+    if (umount2(".", MNT_DETACH) != 0) {
+        perror("umount old root");
+        return -1;
+    }
+    if (chdir("/") != 0) {
+        perror("chdir failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Filesystem type from the image's superblock magic; NULL if unrecognised.
+static const char *image_fstype(int fd) {
+    unsigned char magic[4];
+    if (pread(fd, magic, sizeof(magic), 0) == 4 && memcmp(magic, "hsqs", 4) == 0) {
+        return "squashfs";
+    }
+    // EROFS_SUPER_MAGIC_V1 (0xE0F5E1E2, little endian) at EROFS_SUPER_OFFSET
+    if (pread(fd, magic, sizeof(magic), 1024) == 4 &&
+        magic[0] == 0xe2 && magic[1] == 0xe1 && magic[2] == 0xf5 && magic[3] == 0xe0) {
+        return "erofs";
+    }
+    return NULL;
+}
+
+// Attach image_fd to a free loop device, read-only. Returns the open loop
+// device (the caller closes it once mounted) or -1.
+static int loop_attach(int image_fd, char *dev, size_t len) {
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) {
+        perror("open /dev/loop-control");
+        return -1;
+    }
+
+    int loop = -1;
+    // Someone else can claim the device between GET_FREE and CONFIGURE
+    for (int attempt = 0; attempt < 16 && loop < 0; attempt++) {
+        int n = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (n < 0) {
+            perror("LOOP_CTL_GET_FREE");
+            break;
+        }
+        snprintf(dev, len, "/dev/loop%d", n);
+        int fd = open(dev, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror(dev);
+            break;
+        }
+
+        // Direct I/O keeps the image file itself out of the page cache, so
+        // only the mounted filesystem's pages are cached. Autoclear detaches
+        // the device when its last user (the mount) goes away.
+        struct nsrun_loop_config cfg = { .fd = (uint32_t)image_fd };
+        cfg.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+        int ret = ioctl(fd, LOOP_CONFIGURE, &cfg);
+        if (ret != 0 && errno == EINVAL) {
+            // Backing filesystem cannot do direct I/O (e.g. tmpfs)
+            cfg.info.lo_flags &= ~(uint32_t)LO_FLAGS_DIRECT_IO;
+            ret = ioctl(fd, LOOP_CONFIGURE, &cfg);
+        }
+        if (ret != 0 && errno == EINVAL) {
+            // Pre-5.8 kernels: attach and configure in separate steps
+            ret = ioctl(fd, LOOP_SET_FD, image_fd);
+            if (ret == 0) {
+                struct loop_info64 info = { .lo_flags = LO_FLAGS_AUTOCLEAR };
+                ret = ioctl(fd, LOOP_SET_STATUS64, &info);
+                if (ret != 0) {
+                    ioctl(fd, LOOP_CLR_FD, 0);
+                } else {
+                    ioctl(fd, LOOP_SET_DIRECT_IO, 1UL);
+                }
+            }
+        }
+        if (ret == 0) {
+            loop = fd;
+        } else {
+            if (errno != EBUSY) {
+                perror("configure loop device");
+                close(fd);
+                break;
+            }
+            close(fd);
+        }
+    }
+    close(ctl);
+    return loop;
+}
+
+// Non-zero if something is mounted on path.
+static int is_mounted(const char *path) {
+    char parent[PATH_MAX];
+    struct stat st, pst;
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    return stat(path, &st) == 0 && stat(parent, &pst) == 0 && st.st_dev != pst.st_dev;
+}
+
+// Mount the image read-only at path through a fresh loop device.
+static int mount_image(const char *image, const char *path) {
+    int img = open(image, O_RDONLY | O_CLOEXEC);
+    if (img < 0) {
+        perror(image);
+        return -1;
+    }
+    const char *fstype = image_fstype(img);
+    if (!fstype) {
+        fprintf(stderr, "%s: not a squashfs or erofs image\n", image);
+        close(img);
+        return -1;
+    }
+    char dev[32];
+    int loop = loop_attach(img, dev, sizeof(dev));
+    close(img); // The loop device holds its own reference
+    if (loop < 0) {
+        return -1;
+    }
+
+    int ret = -1;
+    int fs = sys_fsopen(fstype, FSOPEN_CLOEXEC);
+    if (fs < 0) {
+        perror("fsopen image");
+    } else if (sys_fsconfig(fs, FSCONFIG_SET_STRING, "source", dev, 0) != 0 ||
+               sys_fsconfig(fs, FSCONFIG_SET_FLAG, "ro", NULL, 0) != 0 ||
+               sys_fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0) {
+        perror("fsconfig image");
+    } else {
+        int mnt = sys_fsmount(fs, FSMOUNT_CLOEXEC, MOUNT_ATTR_RDONLY | MOUNT_ATTR_NODEV);
+        if (mnt < 0) {
+            perror("fsmount image");
+        } else {
+            ret = attach_at(mnt, path);
+        }
+    }
+    if (fs >= 0) {
+        close(fs);
+    }
+    // Once mounted the filesystem keeps the device open; on failure this
+    // last close lets autoclear detach it again
+    close(loop);
+    return ret;
+}
+
+// Detach templates whose rootfs is the filesystem on dev, so the image's
+// superblock (and its loop device) can actually go away.
+static void drop_templates(dev_t dev) {
+    DIR *d = opendir(NSRUN_TEMPLATE_DIR);
+    if (!d) {
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strchr(ent->d_name, '.')) {
+            continue; // ".", "..", and the .lock/.ready/.users sidecars
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", NSRUN_TEMPLATE_DIR, ent->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || st.st_dev != dev) {
+            continue;
+        }
+        // The image is going away whoever holds the template
+        drop_template(ent->d_name, 1);
+    }
+    closedir(d);
+}
+
+static int lock_image(const char *path) {
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    int lock = open(lock_path, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    if (lock < 0) {
+        perror("open image lock");
+        return -1;
+    }
+    if (flock(lock, LOCK_EX) != 0) {
+        perror("flock image lock");
+        close(lock);
+        return -1;
+    }
+    return lock;
+}
+
+int mounts_is_image(const char *rootfs) {
+    struct stat st;
+    return rootfs && stat(rootfs, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+int mounts_image_path(const char *image, char *path, size_t len) {
+    if (!image || !path) {
+        return -1;
+    }
+    char real[PATH_MAX];
+    struct stat st;
+    if (!realpath(image, real) || stat(real, &st) != 0) {
+        perror(image);
+        return -1;
+    }
+    // Identity includes the file's version, so a rebuilt image gets its own
+    // mount while containers of the old one keep running
+    char version[128];
+    snprintf(version, sizeof(version), "%llu:%llu:%lld:%lld.%ld",
+             (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+             (long long)st.st_size, (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+    unsigned long long key = fnv_mix(fnv_mix(1469598103934665603ULL, real), version);
+    if ((size_t)snprintf(path, len, "%s/%016llx", NSRUN_IMAGE_DIR, key) >= len) {
+        return -1;
+    }
+    return 0;
+}
+
+int mounts_image_acquire(const char *image, const char *path, const char *id) {
+    if (!image || !path || !id) {
+        return -1;
+    }
+    if (util_mkdir_p(NSRUN_IMAGE_DIR, 0700) != 0) {
+        perror("mkdir " NSRUN_IMAGE_DIR);
+        return -1;
+    }
+    int lock = lock_image(path);
+    if (lock < 0) {
+        return -1;
+    }
+
+    int ret = 0;
+    if (!is_mounted(path)) {
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            perror("mkdir image mountpoint");
+            ret = -1;
+        } else {
+            ret = mount_image(image, path);
+        }
+    }
+
+    // One file per user; the mount goes away with the last one
+    if (ret == 0) {
+        char ref[PATH_MAX];
+        snprintf(ref, sizeof(ref), "%s.refs", path);
+        if (mkdir(ref, 0700) != 0 && errno != EEXIST) {
+            perror("mkdir image refs");
+            ret = -1;
+        } else {
+            snprintf(ref, sizeof(ref), "%s.refs/%s", path, id);
+            int fd = open(ref, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+            if (fd < 0) {
+                perror("create image ref");
+                ret = -1;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    close(lock);
+    return ret;
+}
+
+int mounts_image_release(const char *path, const char *id) {
+    if (!path || !id) {
+        return -1;
+    }
+    int lock = lock_image(path);
+    if (lock < 0) {
+        return -1;
+    }
+
+    char refs[PATH_MAX];
+    char ref[PATH_MAX];
+    snprintf(refs, sizeof(refs), "%s.refs", path);
+    snprintf(ref, sizeof(ref), "%s.refs/%s", path, id);
+    unlink(ref);
+
+    int ret = 0;
+    if (rmdir(refs) == 0 || errno == ENOENT) {
+        struct stat st;
+        if (is_mounted(path) && stat(path, &st) == 0) {
+            drop_templates(st.st_dev);
+            if (umount2(path, MNT_DETACH) != 0) {
+                perror("umount image");
+                ret = -1;
+            }
+        }
+        rmdir(path);
+    } else if (errno != ENOTEMPTY && errno != EEXIST) {
+        perror("rmdir image refs");
+        ret = -1;
+    }
+
+    close(lock);
+    return ret;
+}
@@ -0,0 +1,75 @@
+// mounts.h - Container mount tree templates built with the new mount API
+
+#ifndef NSRUN_MOUNTS_H
+#define NSRUN_MOUNTS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Directory holding attached template trees, one per rootfs/volume combination.
+#define NSRUN_TEMPLATE_DIR "/run/nsrun/templates"
+
+// Mountpoints of image rootfs files, shared by every container of an image.
+#define NSRUN_IMAGE_DIR "/run/nsrun/images"
+
+// A host path bound into the container (--volume host:container[:ro]).
+typedef struct MountVolume {
+	char *source;   // Host path
+	char *target;   // Absolute path inside the container
+	int read_only;  // Non-zero to bind read-only
+	struct MountVolume *next;
+} MountVolume;
+
+// Everything that determines the shape of a template tree.
+typedef struct MountConfig {
+	const char *rootfs;          // Container root filesystem directory
+	const MountVolume *volumes;  // Optional list of volume binds
+} MountConfig;
+
+// Parse "host:container[:ro]" into a newly allocated volume; NULL on error.
+MountVolume *mounts_parse_volume(const char *spec);
+
+// Free a list of volumes.
+void mounts_free_volumes(MountVolume *volumes);
+
+// Host side: make sure a template tree for cfg is attached under
+// NSRUN_TEMPLATE_DIR, building it on first use. The template path is written
+// to path. The calling process holds the template in use until it exits.
+// Returns 0 on success, -1 on error.
+int mounts_prepare_template(const MountConfig *cfg, char *path, size_t len);
+
+// Detach and remove templates no running nsrun process holds.
+// Returns the number dropped.
+int mounts_drop_unused_templates(void);
+
+// Child side (inside a fresh mount namespace): clone the template, attach it,
+// apply nosuid recursively, mount proc/sys and /dev/shm for this container
+// and pivot into it. read_only makes everything but the rw volumes (and
+// /dev/shm) read-only. Returns 0 on success, -1 on error.
+int mounts_enter_template(const char *template_path, int read_only,
+                          const MountVolume *volumes);
+
+// Non-zero if rootfs is an image file rather than a directory.
+int mounts_is_image(const char *rootfs);
+
+// Where the image is (or will be) mounted: NSRUN_IMAGE_DIR/<key>, keyed on
+// the image's path and version. Returns 0 on success, -1 on error.
+int mounts_image_path(const char *image, char *path, size_t len);
+
+// Take a reference on the shared read-only mount of a squashfs/erofs image
+// for container id, attaching a loop device and mounting it at path if this
+// is the first user. Returns 0 on success, -1 on error.
+int mounts_image_acquire(const char *image, const char *path, const char *id);
+
+// Drop id's reference. The last one detaches templates built on the image
+// and unmounts it, which frees the loop device. Returns 0 on success, -1 on error.
+int mounts_image_release(const char *path, const char *id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_MOUNTS_H
@@ -107,9 +107,10 @@ int net_attach_to_bridge(const char *if_name, const char *br_name) {
     return 0;
 }
 
-// Move an interface to a target network namespace (by pid); returns 0 on success.
-int net_move_if_to_ns(const char *if_name, pid_t target_pid) {
-    if (validate_if_name(if_name) < 0) {
+// Move an interface to a target network namespace (by pid), renaming it on
+// the way when new_name is set; returns 0 on success.
+int net_move_if_to_ns(const char *if_name, pid_t target_pid, const char *new_name) {
+    if (validate_if_name(if_name) < 0 || (new_name && validate_if_name(new_name) < 0)) {
         fprintf(stderr, "Invalid interface name\n");
         return -1;
     }
@@ -119,8 +120,10 @@ int net_move_if_to_ns(const char *if_name, pid_t target_pid) {
         return -1;
     }
 
+    // One request: the name only has to be unique in the target namespace
     char cmd[256];
-    snprintf(cmd, sizeof(cmd), "ip link set %s netns %d", if_name, target_pid);
+    snprintf(cmd, sizeof(cmd), "ip link set %s netns %d%s%s", if_name, target_pid,
+             new_name ? " name " : "", new_name ? new_name : "");
     
     if (safe_system(cmd) < 0) {
         fprintf(stderr, "Failed to move %s to namespace %d\n", if_name, target_pid);
@@ -130,6 +133,29 @@ int net_move_if_to_ns(const char *if_name, pid_t target_pid) {
     return 0;
 }
 
+// Delete a host interface (and its veth peer); a missing interface is not an error.
+int net_delete_if(const char *if_name) {
+    if (validate_if_name(if_name) < 0) {
+        fprintf(stderr, "Invalid interface name\n");
+        return -1;
+    }
+
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "ip link show %s >/dev/null 2>&1", if_name);
+    if (system(cmd) != 0) {
+        // Already gone (e.g. freed together with the container's netns)
+        return 0;
+    }
+
+    snprintf(cmd, sizeof(cmd), "ip link del %s", if_name);
+    if (safe_system(cmd) < 0) {
+        fprintf(stderr, "Failed to delete interface %s\n", if_name);
+        return -1;
+    }
+
+    return 0;
+}
+
 // Configure an interface inside a netns with IP/mask and bring it up; 0 on success.
 int net_configure_if_in_ns(pid_t target_pid, const char *if_name,
 						   const char *cidr, const char *gw) {
@@ -151,21 +177,21 @@ int net_configure_if_in_ns(pid_t target_pid, const char *if_name,
     char cmd[512];
     
     // Configure the interface with the given IP/mask
-    snprintf(cmd, sizeof(cmd), "ip netns exec %d ip addr add %s dev %s", target_pid, cidr, if_name);
+    snprintf(cmd, sizeof(cmd), "nsenter --target %d --net ip addr add %s dev %s", target_pid, cidr, if_name);
     if (safe_system(cmd) < 0) {
         fprintf(stderr, "Failed to configure IP %s on %s in namespace %d\n", cidr, if_name, target_pid);
         return -1;
     }
 
     // Bring the interface up
-    snprintf(cmd, sizeof(cmd), "ip netns exec %d ip link set %s up", target_pid, if_name);
+    snprintf(cmd, sizeof(cmd), "nsenter --target %d --net ip link set %s up", target_pid, if_name);
     if (safe_system(cmd) < 0) {
         fprintf(stderr, "Failed to bring %s up in namespace %d\n", if_name, target_pid);
         return -1;
     }
 
     // Bring up loopback interface
-    snprintf(cmd, sizeof(cmd), "ip netns exec %d ip link set lo up", target_pid);
+    snprintf(cmd, sizeof(cmd), "nsenter --target %d --net ip link set lo up", target_pid);
     if (safe_system(cmd) < 0) {
         fprintf(stderr, "Failed to bring up loopback in namespace %d\n", target_pid);
         return -1;
@@ -173,7 +199,7 @@ int net_configure_if_in_ns(pid_t target_pid, const char *if_name,
 
     // Configure the default gateway if provided
     if (gw && strlen(gw) > 0) {
-        snprintf(cmd, sizeof(cmd), "ip netns exec %d ip route add default via %s", target_pid, gw);
+        snprintf(cmd, sizeof(cmd), "nsenter --target %d --net ip route add default via %s", target_pid, gw);
         if (safe_system(cmd) < 0) {
             fprintf(stderr, "Failed to configure gateway %s in namespace %d\n", gw, target_pid);
             return -1;
@@ -21,10 +21,15 @@ int net_ensure_bridge(const char *br_name);
 // Attach an interface to the bridge; returns 0 on success.
 int net_attach_to_bridge(const char *if_name, const char *br_name);
 
-// Move an interface to a target network namespace (by pid); returns 0 on success.
-int net_move_if_to_ns(const char *if_name, pid_t target_pid);
+// Move an interface to a target network namespace (by pid), renaming it on
+// the way when new_name is set; returns 0 on success.
+int net_move_if_to_ns(const char *if_name, pid_t target_pid, const char *new_name);
 
-// Configure an interface inside a netns with IP/mask and bring it up; 0 on success.
+// Delete a host interface (and its veth peer); a missing interface is not an error.
+int net_delete_if(const char *if_name);
+
+// Configure an interface inside the netns of target_pid (via nsenter, run from
+// the host) with IP/mask and bring it up; 0 on success.
 int net_configure_if_in_ns(pid_t target_pid, const char *if_name,
 						   const char *cidr, const char *gw);
 
@@ -0,0 +1,263 @@
+#include "perf.h"
+#include "cgroups.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef PERF_FLAG_FD_CLOEXEC
+#define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+#endif
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} events[PERF_CTR_MAX] = {
+    [PERF_CTR_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    [PERF_CTR_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+    [PERF_CTR_LLC_REFERENCES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "llc-references" },
+    [PERF_CTR_LLC_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc-misses" },
+    [PERF_CTR_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+    [PERF_CTR_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+    [PERF_CTR_PAGE_FAULTS] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+    [PERF_CTR_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" },
+};
+
+// One event group on one CPU; order[i] is the counter at position i of a
+// PERF_FORMAT_GROUP read.
+struct CpuGroup {
+    int fd[PERF_CTR_MAX];
+    PerfCounter order[PERF_CTR_MAX];
+    int n;
+};
+
+struct PerfGroup {
+    struct CpuGroup *cpus;
+    int ncpus;
+    int hardware;
+    unsigned available;
+};
+
+static int open_event(PerfCounter c, int cgroup_fd, int cpu, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[c].type;
+    attr.config = events[c].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // The leader starts disabled so the whole group is enabled at once
+    attr.disabled = group_fd < 0;
+    return (int)syscall(SYS_perf_event_open, &attr, cgroup_fd, cpu, group_fd,
+                        PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+}
+
+// Online CPUs from "0-3,6"-style list; cgroup events must be per CPU.
+static int online_cpus(int **cpus) {
+    int cap = 64;
+    int n = 0;
+    int *list = malloc(sizeof(int) * (size_t)cap);
+    if (!list) {
+        return -1;
+    }
+
+    FILE *f = fopen("/sys/devices/system/cpu/online", "re");
+    if (f) {
+        int lo, hi;
+        while (fscanf(f, "%d", &lo) == 1) {
+            hi = lo;
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%d", &hi) != 1) {
+                    break;
+                }
+                c = fgetc(f);
+            }
+            for (int cpu = lo; cpu <= hi; cpu++) {
+                if (n == cap) {
+                    cap *= 2;
+                    int *grown = realloc(list, sizeof(int) * (size_t)cap);
+                    if (!grown) {
+                        fclose(f);
+                        free(list);
+                        return -1;
+                    }
+                    list = grown;
+                }
+                list[n++] = cpu;
+            }
+            if (c != ',') {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    if (n == 0) {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < count && cpu < cap; cpu++) {
+            list[n++] = cpu;
+        }
+    }
+    *cpus = list;
+    return n;
+}
+
+static void close_cpu(struct CpuGroup *cg) {
+    for (int i = 0; i < cg->n; i++) {
+        close(cg->fd[i]);
+    }
+    cg->n = 0;
+}
+
+// Open one group on cpu led by leader; members that fail are left out.
+static int open_cpu(struct CpuGroup *cg, int cgroup_fd, int cpu, PerfCounter leader,
+                    int hardware) {
+    cg->n = 0;
+    int lfd = open_event(leader, cgroup_fd, cpu, -1);
+    if (lfd < 0) {
+        return -1;
+    }
+    cg->fd[cg->n] = lfd;
+    cg->order[cg->n++] = leader;
+
+    for (int c = 0; c < PERF_CTR_MAX; c++) {
+        if ((PerfCounter)c == leader || (!hardware && events[c].type == PERF_TYPE_HARDWARE)) {
+            continue;
+        }
+        int fd = open_event((PerfCounter)c, cgroup_fd, cpu, lfd);
+        if (fd >= 0) {
+            cg->fd[cg->n] = fd;
+            cg->order[cg->n++] = (PerfCounter)c;
+        }
+    }
+
+    if (ioctl(lfd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0) {
+        close_cpu(cg);
+        return -1;
+    }
+    return 0;
+}
+
+PerfGroup *perf_open(const char *cgroup) {
+    if (!cgroup) {
+        return NULL;
+    }
+
+    // On cgroup v1 the events follow the perf_event hierarchy
+    char path[512];
+    if (cgroups_path(cgroup, "perf_event", path, sizeof(path)) != 0) {
+        fprintf(stderr, "perf_event cgroup hierarchy is not mounted\n");
+        return NULL;
+    }
+    int cgroup_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_fd < 0) {
+        perror("open cgroup");
+        return NULL;
+    }
+
+    int *cpus = NULL;
+    int ncpus = online_cpus(&cpus);
+    PerfGroup *g = calloc(1, sizeof(PerfGroup));
+    if (ncpus <= 0 || !g || !(g->cpus = calloc((size_t)ncpus, sizeof(struct CpuGroup)))) {
+        free(g);
+        free(cpus);
+        close(cgroup_fd);
+        return NULL;
+    }
+
+    // Cycles leads the group when the PMU is usable (bare metal, most
+    // KVM guests); otherwise task-clock leads a software-only group
+    g->hardware = 1;
+    int err = 0;
+    for (int i = 0; i < ncpus; i++) {
+        struct CpuGroup *cg = &g->cpus[g->ncpus];
+        int hw = g->hardware && open_cpu(cg, cgroup_fd, cpus[i], PERF_CTR_CYCLES, 1) == 0;
+        if (!hw && g->ncpus == 0) {
+            g->hardware = 0;
+        }
+        // Hybrid CPUs may lack the PMU event on some cores; count software there
+        if (!hw && open_cpu(cg, cgroup_fd, cpus[i], PERF_CTR_TASK_CLOCK, 0) != 0) {
+            err = errno;
+            continue;
+        }
+        for (int j = 0; j < cg->n; j++) {
+            g->available |= 1u << cg->order[j];
+        }
+        g->ncpus++;
+    }
+    free(cpus);
+    close(cgroup_fd);
+
+    if (g->ncpus == 0) {
+        errno = err;
+        perror("perf_event_open");
+        perf_close(g);
+        return NULL;
+    }
+    return g;
+}
+
+int perf_read(PerfGroup *g, PerfSample *s) {
+    if (!g || !s) {
+        return -1;
+    }
+    memset(s, 0, sizeof(*s));
+    s->available = g->available;
+
+    // nr, time_enabled, time_running, then one value per member
+    uint64_t buf[3 + PERF_CTR_MAX];
+    for (int i = 0; i < g->ncpus; i++) {
+        struct CpuGroup *cg = &g->cpus[i];
+        ssize_t n = read(cg->fd[0], buf, sizeof(buf));
+        if (n < (ssize_t)(3 * sizeof(uint64_t))) {
+            perror("read perf group");
+            return -1;
+        }
+        uint64_t nr = buf[0];
+        uint64_t enabled = buf[1];
+        uint64_t running = buf[2];
+        if (running == 0 || nr > (uint64_t)cg->n) {
+            continue; // Never scheduled on this CPU
+        }
+        // Scale up if the PMU was multiplexed between groups
+        double scale = (double)enabled / (double)running;
+        for (uint64_t j = 0; j < nr; j++) {
+            s->value[cg->order[j]] += (unsigned long long)((double)buf[3 + j] * scale);
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    s->time_ns = (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+    return 0;
+}
+
+int perf_has_hardware(const PerfGroup *g) {
+    return g && g->hardware;
+}
+
+void perf_close(PerfGroup *g) {
+    if (!g) {
+        return;
+    }
+    for (int i = 0; i < g->ncpus; i++) {
+        close_cpu(&g->cpus[i]);
+    }
+    free(g->cpus);
+    free(g);
+}
+
+const char *perf_counter_name(PerfCounter c) {
+    if (c < 0 || c >= PERF_CTR_MAX) {
+        return "?";
+    }
+    return events[c].name;
+}
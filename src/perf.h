@@ -0,0 +1,55 @@
+// perf.h - Per-container performance counters via perf_event cgroup mode
+
+#ifndef NSRUN_PERF_H
+#define NSRUN_PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counters opened for each container. Hardware ones are skipped where the
+// CPU (or hypervisor) does not expose them.
+typedef enum PerfCounter {
+	PERF_CTR_CYCLES,
+	PERF_CTR_INSTRUCTIONS,
+	PERF_CTR_LLC_REFERENCES,
+	PERF_CTR_LLC_MISSES,
+	PERF_CTR_BRANCH_MISSES,
+	PERF_CTR_CONTEXT_SWITCHES,
+	PERF_CTR_PAGE_FAULTS,
+	PERF_CTR_TASK_CLOCK,     // Nanoseconds on CPU; always available
+	PERF_CTR_MAX
+} PerfCounter;
+
+// Cumulative counts since perf_open, summed over CPUs and scaled for
+// multiplexing.
+typedef struct PerfSample {
+	unsigned long long value[PERF_CTR_MAX];
+	unsigned available;          // Bit (1 << PerfCounter) set if counted
+	unsigned long long time_ns;  // CLOCK_MONOTONIC when read
+} PerfSample;
+
+// Event groups for one cgroup (one group per online CPU).
+typedef struct PerfGroup PerfGroup;
+
+// Open counter groups on the cgroup directory. Falls back to software
+// events only when no hardware counters are available. NULL on error.
+PerfGroup *perf_open(const char *cgroup);
+
+// Read every group once. Returns 0 on success, -1 on error.
+int perf_read(PerfGroup *g, PerfSample *s);
+
+// Non-zero if hardware counters are being counted.
+int perf_has_hardware(const PerfGroup *g);
+
+// Close all event fds and free the groups.
+void perf_close(PerfGroup *g);
+
+// Short name of a counter, e.g. "cycles".
+const char *perf_counter_name(PerfCounter c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_PERF_H
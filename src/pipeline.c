@@ -0,0 +1,252 @@
+#include "pipeline.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum StepState {
+    STEP_PENDING,
+    STEP_RUNNING,
+    STEP_DONE,
+    STEP_FAILED,
+    STEP_SKIPPED
+} StepState;
+
+typedef struct PipelineStep {
+    const char *name;
+    PipelineFn fn;
+    void *arg;
+    int flags;
+    int deps[PIPELINE_MAX_DEPS];
+    int ndeps;
+    StepState state;
+    double start_ms;
+    double end_ms;
+    int worker; // -1 for the main thread
+} PipelineStep;
+
+struct Pipeline {
+    PipelineStep steps[PIPELINE_MAX_STEPS];
+    int nsteps;
+    int workers;
+    int remaining;
+    int failed;
+    struct timespec t0;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+typedef struct Worker {
+    Pipeline *p;
+    int id;
+} Worker;
+
+static double elapsed_ms(const Pipeline *p) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - p->t0.tv_sec) * 1e3 +
+           (double)(now.tv_nsec - p->t0.tv_nsec) / 1e6;
+}
+
+// Caller holds the lock. Returns a runnable step this thread may take
+// (main-thread steps, other steps, or both) or -1.
+// Steps that can never run (failed dependency or earlier failure) are
+// retired here so the pipeline still drains.
+static int next_ready(Pipeline *p, int take_main, int take_other) {
+    for (int i = 0; i < p->nsteps; i++) {
+        PipelineStep *s = &p->steps[i];
+        if (s->state != STEP_PENDING) {
+            continue;
+        }
+
+        int ready = 1;
+        int doomed = p->failed;
+        for (int d = 0; d < s->ndeps; d++) {
+            StepState dep = p->steps[s->deps[d]].state;
+            if (dep == STEP_FAILED || dep == STEP_SKIPPED) {
+                doomed = 1;
+            } else if (dep != STEP_DONE) {
+                ready = 0;
+            }
+        }
+        if (doomed) {
+            s->state = STEP_SKIPPED;
+            p->remaining--;
+            pthread_cond_broadcast(&p->cond);
+            continue;
+        }
+        int is_main = (s->flags & PIPELINE_MAIN_THREAD) != 0;
+        if (ready && (is_main ? take_main : take_other)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void run_steps(Pipeline *p, int worker, int take_main, int take_other) {
+    pthread_mutex_lock(&p->lock);
+    while (p->remaining > 0) {
+        int i = next_ready(p, take_main, take_other);
+        if (i < 0) {
+            if (p->remaining > 0) {
+                pthread_cond_wait(&p->cond, &p->lock);
+            }
+            continue;
+        }
+
+        PipelineStep *s = &p->steps[i];
+        s->state = STEP_RUNNING;
+        s->worker = worker;
+        s->start_ms = elapsed_ms(p);
+        pthread_mutex_unlock(&p->lock);
+
+        int ret = s->fn ? s->fn(s->arg) : 0;
+
+        pthread_mutex_lock(&p->lock);
+        s->end_ms = elapsed_ms(p);
+        s->state = ret == 0 ? STEP_DONE : STEP_FAILED;
+        if (ret != 0) {
+            p->failed = 1;
+        }
+        p->remaining--;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    run_steps(w->p, w->id, 0, 1);
+    return NULL;
+}
+
+Pipeline *pipeline_create(int workers) {
+    Pipeline *p = calloc(1, sizeof(Pipeline));
+    if (!p) {
+        return NULL;
+    }
+    p->workers = workers > 0 ? workers : 1;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    return p;
+}
+
+int pipeline_add(Pipeline *p, const char *name, PipelineFn fn, void *arg, int flags) {
+    if (!p || p->nsteps >= PIPELINE_MAX_STEPS) {
+        return -1;
+    }
+    PipelineStep *s = &p->steps[p->nsteps];
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->fn = fn;
+    s->arg = arg;
+    s->flags = flags;
+    s->state = STEP_PENDING;
+    s->worker = -1;
+    return p->nsteps++;
+}
+
+int pipeline_depend(Pipeline *p, int step, int on) {
+    if (!p || step < 0 || step >= p->nsteps || on < 0 || on >= p->nsteps ||
+        on == step || p->steps[step].ndeps >= PIPELINE_MAX_DEPS) {
+        return -1;
+    }
+    PipelineStep *s = &p->steps[step];
+    s->deps[s->ndeps++] = on;
+    return 0;
+}
+
+int pipeline_run(Pipeline *p) {
+    if (!p) {
+        return -1;
+    }
+
+    int workers = p->workers < p->nsteps ? p->workers : p->nsteps;
+    pthread_t threads[PIPELINE_MAX_STEPS];
+    Worker ctx[PIPELINE_MAX_STEPS];
+
+    clock_gettime(CLOCK_MONOTONIC, &p->t0);
+    p->remaining = p->nsteps;
+    p->failed = 0;
+
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        ctx[i].p = p;
+        ctx[i].id = i;
+        if (pthread_create(&threads[i], NULL, worker_main, &ctx[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+
+    // The calling thread handles PIPELINE_MAIN_THREAD steps; if no worker
+    // could be started it runs everything itself.
+    run_steps(p, -1, 1, started == 0);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return p->failed ? -1 : 0;
+}
+
+int pipeline_step_done(const Pipeline *p, int step) {
+    return p && step >= 0 && step < p->nsteps && p->steps[step].state == STEP_DONE;
+}
+
+void pipeline_trace(const Pipeline *p, FILE *out) {
+    static const char *const states[] = { "pending", "running", "ok", "failed", "skipped" };
+    if (!p || !out) {
+        return;
+    }
+
+    fprintf(out, "setup trace (ms since start)\n");
+    fprintf(out, "  %-16s %9s %9s %9s  %-6s %s\n", "step", "start", "end", "took", "thread", "result");
+    int last = -1;
+    for (int i = 0; i < p->nsteps; i++) {
+        const PipelineStep *s = &p->steps[i];
+        char thread[16];
+        if (s->worker < 0) {
+            snprintf(thread, sizeof(thread), "main");
+        } else {
+            snprintf(thread, sizeof(thread), "w%d", s->worker);
+        }
+        fprintf(out, "  %-16s %9.3f %9.3f %9.3f  %-6s %s\n", s->name, s->start_ms, s->end_ms,
+                s->end_ms - s->start_ms, thread, states[s->state]);
+        if (s->state == STEP_DONE && (last < 0 || s->end_ms > p->steps[last].end_ms)) {
+            last = i;
+        }
+    }
+    if (last < 0) {
+        return;
+    }
+
+    // Walk back from the last step to finish through whichever dependency
+    // released it (the one that finished last)
+    int path[PIPELINE_MAX_STEPS];
+    int len = 0;
+    for (int i = last; i >= 0 && len < PIPELINE_MAX_STEPS; ) {
+        path[len++] = i;
+        int next = -1;
+        for (int d = 0; d < p->steps[i].ndeps; d++) {
+            int dep = p->steps[i].deps[d];
+            if (next < 0 || p->steps[dep].end_ms > p->steps[next].end_ms) {
+                next = dep;
+            }
+        }
+        i = next;
+    }
+
+    fprintf(out, "critical path (%.3f ms):", p->steps[last].end_ms);
+    for (int i = len - 1; i >= 0; i--) {
+        fprintf(out, " %s%s", p->steps[path[i]].name, i > 0 ? " ->" : "\n");
+    }
+}
+
+void pipeline_destroy(Pipeline *p) {
+    if (!p) {
+        return;
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p);
+}
@@ -0,0 +1,48 @@
+// pipeline.h - Tiny dependency-graph executor for container setup steps
+
+#ifndef NSRUN_PIPELINE_H
+#define NSRUN_PIPELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#define PIPELINE_MAX_STEPS 32
+#define PIPELINE_MAX_DEPS 8
+
+// Step flags
+#define PIPELINE_MAIN_THREAD 0x1 // Run on the thread calling pipeline_run (e.g. clone)
+
+// A step returns 0 on success, -1 on failure. Steps that depend on a failed
+// step are skipped, and no new steps start once anything has failed.
+typedef int (*PipelineFn)(void *arg);
+
+typedef struct Pipeline Pipeline;
+
+// Create a pipeline that runs independent steps on up to `workers` threads.
+Pipeline *pipeline_create(int workers);
+
+// Add a step; returns its id (>= 0) or -1 if the pipeline is full.
+int pipeline_add(Pipeline *p, const char *name, PipelineFn fn, void *arg, int flags);
+
+// Declare that `step` may only start after `on` succeeded. 0 on success.
+int pipeline_depend(Pipeline *p, int step, int on);
+
+// Run every step, respecting dependencies. Returns 0 if all succeeded.
+int pipeline_run(Pipeline *p);
+
+// Non-zero if the step ran and succeeded.
+int pipeline_step_done(const Pipeline *p, int step);
+
+// Print per-step timings and the critical path.
+void pipeline_trace(const Pipeline *p, FILE *out);
+
+void pipeline_destroy(Pipeline *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_PIPELINE_H
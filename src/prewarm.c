@@ -0,0 +1,335 @@
+#include "prewarm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+#ifndef RESOLVE_NO_MAGICLINKS
+#define RESOLVE_NO_MAGICLINKS 0x02
+#endif
+#ifndef RESOLVE_IN_ROOT
+#define RESOLVE_IN_ROOT 0x10
+#endif
+
+// Same layout as the kernel's struct open_how (OPEN_HOW_SIZE_VER0).
+struct nsrun_open_how {
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+
+// Profile format, one resident range per line (paths relative to rootfs):
+//   # nsrun prewarm v1
+//   <path>\t<offset>\t<length>
+
+#define PROFILE_HEADER "# nsrun prewarm v1\n"
+
+// nftw() has no user argument; walks are never concurrent in nsrun
+static struct {
+    size_t root_len;
+    FILE *out;
+    PrewarmStats *stats;
+    long page;
+} walk;
+
+struct PrewarmRecorder {
+    char rootfs[PATH_MAX];
+    char profile[PATH_MAX];
+    struct timespec deadline;
+    int stop;
+    int written;
+    PrewarmStats stats;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+int prewarm_profile_path(const char *rootfs, char *path, size_t len) {
+    if (!rootfs || !*rootfs) {
+        return -1;
+    }
+    // Strip trailing slashes so "./rootfs/" maps to "./rootfs.prewarm"
+    size_t n = strlen(rootfs);
+    while (n > 1 && rootfs[n - 1] == '/') {
+        n--;
+    }
+    if ((size_t)snprintf(path, len, "%.*s%s", (int)n, rootfs, PREWARM_SUFFIX) >= len) {
+        return -1;
+    }
+    return 0;
+}
+
+static int evict_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode) || st->st_size == 0) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0) {
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return 0;
+}
+
+int prewarm_evict(const char *rootfs) {
+    if (!rootfs) {
+        return -1;
+    }
+    if (nftw(rootfs, evict_file, 64, FTW_PHYS | FTW_MOUNT) != 0) {
+        perror("walk rootfs");
+        return -1;
+    }
+    return 0;
+}
+
+static void emit_range(const char *rel, unsigned long long off, unsigned long long len) {
+    fprintf(walk.out, "%s\t%llu\t%llu\n", rel, off, len);
+    walk.stats->bytes += len;
+}
+
+static int record_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode) || st->st_size == 0) {
+        return 0;
+    }
+    const char *rel = path + walk.root_len;
+    while (*rel == '/') {
+        rel++;
+    }
+    if (strpbrk(rel, "\t\n")) {
+        return 0; // Not representable in the profile
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0) {
+        return 0;
+    }
+    size_t size = (size_t)st->st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    size_t pages = (size + (size_t)walk.page - 1) / (size_t)walk.page;
+    unsigned char *vec = malloc(pages);
+    if (vec && mincore(map, size, vec) == 0) {
+        // Coalesce runs of resident pages into ranges
+        int touched = 0;
+        size_t run = 0;
+        for (size_t i = 0; i <= pages; i++) {
+            int resident = i < pages && (vec[i] & 1);
+            if (resident) {
+                continue;
+            }
+            if (i > run) {
+                unsigned long long off = (unsigned long long)run * (unsigned long long)walk.page;
+                unsigned long long end = (unsigned long long)i * (unsigned long long)walk.page;
+                if (end > size) {
+                    end = size;
+                }
+                emit_range(rel, off, end - off);
+                touched = 1;
+            }
+            run = i + 1;
+        }
+        if (touched) {
+            walk.stats->files++;
+        }
+    }
+    free(vec);
+    munmap(map, size);
+    return 0;
+}
+
+int prewarm_record(const char *rootfs, const char *profile, PrewarmStats *stats) {
+    if (!rootfs || !profile) {
+        return -1;
+    }
+    PrewarmStats local = { 0, 0 };
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", profile);
+    FILE *out = fopen(tmp, "we");
+    if (!out) {
+        perror("open prewarm profile");
+        return -1;
+    }
+    fputs(PROFILE_HEADER, out);
+
+    walk.root_len = strlen(rootfs);
+    walk.out = out;
+    walk.stats = stats;
+    walk.page = sysconf(_SC_PAGESIZE);
+    int ret = nftw(rootfs, record_file, 64, FTW_PHYS | FTW_MOUNT);
+    walk.out = NULL;
+
+    if (fclose(out) != 0 || ret != 0) {
+        perror("write prewarm profile");
+        unlink(tmp);
+        return -1;
+    }
+    if (rename(tmp, profile) != 0) {
+        perror("rename prewarm profile");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Open a profile path below root as if root were "/": the profile and the
+// rootfs may come from anyone, so symlinks and ".." must not leave it.
+static int open_profiled(int root, const char *path) {
+    struct nsrun_open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC | O_NOATIME,
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+    return (int)syscall(SYS_openat2, root, path, &how, sizeof(how));
+}
+
+int prewarm_apply(const char *rootfs, const char *profile, PrewarmStats *stats) {
+    if (!rootfs || !profile) {
+        return -1;
+    }
+    PrewarmStats local = { 0, 0 };
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    FILE *in = fopen(profile, "re");
+    if (!in) {
+        return -1;
+    }
+
+    int root = open(rootfs, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0) {
+        perror("open rootfs");
+        fclose(in);
+        return -1;
+    }
+
+    // Ranges of one file are consecutive; keep it open across its lines
+    char line[PATH_MAX + 64];
+    char current[sizeof(line)] = "";
+    int fd = -1;
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        char *tab1 = strchr(line, '\t');
+        char *tab2 = tab1 ? strchr(tab1 + 1, '\t') : NULL;
+        if (!tab2) {
+            continue;
+        }
+        *tab1 = '\0';
+        unsigned long long off = strtoull(tab1 + 1, NULL, 10);
+        unsigned long long len = strtoull(tab2 + 1, NULL, 10);
+
+        if (strcmp(line, current) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            snprintf(current, sizeof(current), "%s", line);
+            fd = open_profiled(root, line);
+            if (fd >= 0) {
+                stats->files++;
+            }
+        }
+        if (fd >= 0 && posix_fadvise(fd, (off_t)off, (off_t)len, POSIX_FADV_WILLNEED) == 0) {
+            stats->bytes += len;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    close(root);
+    fclose(in);
+    return 0;
+}
+
+static void *recorder_main(void *arg) {
+    PrewarmRecorder *rec = arg;
+
+    pthread_mutex_lock(&rec->lock);
+    while (!rec->stop) {
+        if (pthread_cond_timedwait(&rec->cond, &rec->lock, &rec->deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rec->lock);
+
+    rec->written = prewarm_record(rec->rootfs, rec->profile, &rec->stats) == 0;
+    return NULL;
+}
+
+PrewarmRecorder *prewarm_record_start(const char *rootfs, const char *profile, int window_ms) {
+    if (!rootfs || !profile) {
+        return NULL;
+    }
+    PrewarmRecorder *rec = calloc(1, sizeof(PrewarmRecorder));
+    if (!rec) {
+        return NULL;
+    }
+    snprintf(rec->rootfs, sizeof(rec->rootfs), "%s", rootfs);
+    snprintf(rec->profile, sizeof(rec->profile), "%s", profile);
+
+    // pthread_cond_timedwait defaults to CLOCK_REALTIME
+    clock_gettime(CLOCK_REALTIME, &rec->deadline);
+    rec->deadline.tv_sec += window_ms / 1000;
+    rec->deadline.tv_nsec += (long)(window_ms % 1000) * 1000000L;
+    if (rec->deadline.tv_nsec >= 1000000000L) {
+        rec->deadline.tv_sec++;
+        rec->deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (pthread_create(&rec->thread, NULL, recorder_main, rec) != 0) {
+        pthread_mutex_destroy(&rec->lock);
+        pthread_cond_destroy(&rec->cond);
+        free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+int prewarm_record_finish(PrewarmRecorder *rec, PrewarmStats *stats) {
+    if (!rec) {
+        return -1;
+    }
+    pthread_mutex_lock(&rec->lock);
+    rec->stop = 1;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    pthread_join(rec->thread, NULL);
+
+    int ret = rec->written ? 0 : -1;
+    if (stats) {
+        *stats = rec->stats;
+    }
+    pthread_mutex_destroy(&rec->lock);
+    pthread_cond_destroy(&rec->cond);
+    free(rec);
+    return ret;
+}
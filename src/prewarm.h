@@ -0,0 +1,52 @@
+// prewarm.h - Rootfs page-cache prewarming from recorded access profiles
+
+#ifndef NSRUN_PREWARM_H
+#define NSRUN_PREWARM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Profiles live next to the rootfs: <rootfs>.prewarm
+#define PREWARM_SUFFIX ".prewarm"
+
+// Default time after launch before a recording snapshot is taken.
+#define PREWARM_RECORD_WINDOW_MS 5000
+
+typedef struct PrewarmStats {
+	size_t files;                 // Files touched
+	unsigned long long bytes;     // Bytes recorded or prefetched
+} PrewarmStats;
+
+// Background recorder started after launch; see prewarm_record_start.
+typedef struct PrewarmRecorder PrewarmRecorder;
+
+// Path of the profile that belongs to rootfs. Returns 0 on success, -1 on error.
+int prewarm_profile_path(const char *rootfs, char *path, size_t len);
+
+// Drop the rootfs's clean pages from the page cache so a recording only
+// sees what the container itself faults in. Returns 0 on success, -1 on error.
+int prewarm_evict(const char *rootfs);
+
+// Snapshot which pages of each rootfs file are resident (mincore) and save
+// them as a profile. stats may be NULL. Returns 0 on success, -1 on error.
+int prewarm_record(const char *rootfs, const char *profile, PrewarmStats *stats);
+
+// Ask the kernel to read every range in the profile (POSIX_FADV_WILLNEED,
+// which only queues the I/O). stats may be NULL. Returns 0 on success, -1 on error.
+int prewarm_apply(const char *rootfs, const char *profile, PrewarmStats *stats);
+
+// Take a recording window_ms from now, or earlier at prewarm_record_finish.
+PrewarmRecorder *prewarm_record_start(const char *rootfs, const char *profile, int window_ms);
+
+// Stop the recorder (snapshotting now if the window has not elapsed yet).
+// Returns 0 if a profile was written, -1 otherwise.
+int prewarm_record_finish(PrewarmRecorder *rec, PrewarmStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_PREWARM_H
@@ -0,0 +1,199 @@
+#include "state.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int state_path(const char *id, const char *file, char *path, size_t len) {
+    if (!id || !*id || strchr(id, '/') || id[0] == '.') {
+        return -1;
+    }
+    if ((size_t)snprintf(path, len, "%s/%s%s%s", NSRUN_STATE_DIR, id,
+                         file ? "/" : "", file ? file : "") >= len) {
+        return -1;
+    }
+    return 0;
+}
+
+int state_save(const ContainerState *st) {
+    if (!st) {
+        return -1;
+    }
+
+    char dir[PATH_MAX];
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+    if (state_path(st->id, NULL, dir, sizeof(dir)) != 0 ||
+        state_path(st->id, "state.tmp", tmp, sizeof(tmp)) != 0 ||
+        state_path(st->id, "state", path, sizeof(path)) != 0) {
+        return -1;
+    }
+    if (util_mkdir_p(dir, 0700) != 0) {
+        perror("mkdir state dir");
+        return -1;
+    }
+
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        perror("open state");
+        return -1;
+    }
+    fprintf(f, "supervisor=%d\n", (int)st->supervisor);
+    fprintf(f, "supervisor_start=%llu\n", st->supervisor_start);
+    fprintf(f, "pid=%d\n", (int)st->pid);
+    fprintf(f, "cgroup=%s\n", st->cgroup);
+    fprintf(f, "host_if=%s\n", st->host_if);
+    fprintf(f, "image=%s\n", st->image);
+    fprintf(f, "rootfs=%s\n", st->rootfs);
+    fprintf(f, "ksm=%d\n", st->ksm);
+    fprintf(f, "thp=%d\n", st->thp);
+    if (fclose(f) != 0) {
+        perror("write state");
+        unlink(tmp);
+        return -1;
+    }
+
+    // Readers never see a half-written record
+    if (rename(tmp, path) != 0) {
+        perror("rename state");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int state_load(const char *id, ContainerState *st) {
+    char path[PATH_MAX];
+    if (!st || state_path(id, "state", path, sizeof(path)) != 0) {
+        return -1;
+    }
+
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        return -1;
+    }
+
+    memset(st, 0, sizeof(*st));
+    snprintf(st->id, sizeof(st->id), "%s", id);
+
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *value = strchr(line, '=');
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+
+        if (strcmp(line, "supervisor") == 0) {
+            st->supervisor = (pid_t)atoi(value);
+        } else if (strcmp(line, "supervisor_start") == 0) {
+            st->supervisor_start = strtoull(value, NULL, 10);
+        } else if (strcmp(line, "pid") == 0) {
+            st->pid = (pid_t)atoi(value);
+        } else if (strcmp(line, "cgroup") == 0) {
+            snprintf(st->cgroup, sizeof(st->cgroup), "%s", value);
+        } else if (strcmp(line, "host_if") == 0) {
+            snprintf(st->host_if, sizeof(st->host_if), "%s", value);
+        } else if (strcmp(line, "image") == 0) {
+            snprintf(st->image, sizeof(st->image), "%s", value);
+        } else if (strcmp(line, "rootfs") == 0) {
+            snprintf(st->rootfs, sizeof(st->rootfs), "%s", value);
+        } else if (strcmp(line, "ksm") == 0) {
+            st->ksm = atoi(value);
+        } else if (strcmp(line, "thp") == 0) {
+            st->thp = atoi(value);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+int state_remove(const char *id) {
+    char dir[PATH_MAX];
+    if (state_path(id, NULL, dir, sizeof(dir)) != 0) {
+        return -1;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] != '.') {
+            unlinkat(dirfd(d), ent->d_name, 0);
+        }
+    }
+    closedir(d);
+
+    if (rmdir(dir) != 0 && errno != ENOENT) {
+        perror("rmdir state dir");
+        return -1;
+    }
+    return 0;
+}
+
+unsigned long long state_process_start(pid_t pid) {
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buf[n] = '\0';
+
+    // comm may contain spaces; count fields from the closing parenthesis
+    char *p = strrchr(buf, ')');
+    if (!p) {
+        return 0;
+    }
+    // p[2] is field 3 (state); starttime is field 22
+    p += 2;
+    for (int field = 3; field < 22 && p; field++) {
+        p = strchr(p, ' ');
+        if (p) {
+            p++;
+        }
+    }
+    return p ? strtoull(p, NULL, 10) : 0;
+}
+
+int state_supervisor_alive(const ContainerState *st) {
+    if (!st || st->supervisor <= 0) {
+        return 0;
+    }
+    unsigned long long start = state_process_start(st->supervisor);
+    return start != 0 && start == st->supervisor_start;
+}
+
+int state_foreach(int (*fn)(const ContainerState *st, void *arg), void *arg) {
+    DIR *d = opendir(NSRUN_STATE_DIR);
+    if (!d) {
+        return 0;
+    }
+
+    int ret = 0;
+    struct dirent *ent;
+    while (ret == 0 && (ent = readdir(d)) != NULL) {
+        ContainerState st;
+        if (ent->d_name[0] == '.' || state_load(ent->d_name, &st) != 0) {
+            continue;
+        }
+        ret = fn(&st, arg);
+    }
+    closedir(d);
+    return ret;
+}
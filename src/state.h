@@ -0,0 +1,55 @@
+// state.h - Runtime records for live containers under /run/nsrun
+
+#ifndef NSRUN_STATE_H
+#define NSRUN_STATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+// One directory per container: NSRUN_STATE_DIR/<id>/state
+#define NSRUN_STATE_DIR "/run/nsrun/containers"
+
+// What later commands (teardown, reaper, ...) need to find a container again.
+typedef struct ContainerState {
+	char id[64];                          // e.g. "nsrun-1234"
+	pid_t supervisor;                     // nsrun process that owns the container
+	unsigned long long supervisor_start;  // its start time, to detect pid reuse
+	pid_t pid;                            // Container init as seen from the host; 0 before clone
+	char cgroup[256];                     // Cgroup directory
+	char host_if[32];                     // Host side of the veth pair; empty if none
+	char image[256];                      // Shared image mount in use; empty for a directory rootfs
+	char rootfs[256];                     // Resolved rootfs directory (the image mount for images)
+	int ksm;                              // Memory policy, for commands run by nsrun exec
+	int thp;                              // (MemoryPolicy.ksm, ThpMode)
+} ContainerState;
+
+// Path of file in id's state directory (the directory itself when file is
+// NULL). Returns 0 on success, -1 for an invalid id or a too-long path.
+int state_path(const char *id, const char *file, char *path, size_t len);
+
+// Write (or rewrite) the record atomically. Returns 0 on success, -1 on error.
+int state_save(const ContainerState *st);
+
+// Load the record for id. Returns 0 on success, -1 if missing or unreadable.
+int state_load(const char *id, ContainerState *st);
+
+// Remove the record. Returns 0 on success, -1 on error.
+int state_remove(const char *id);
+
+// Start time of a process (field 22 of /proc/<pid>/stat); 0 if it is gone.
+unsigned long long state_process_start(pid_t pid);
+
+// Non-zero if the supervisor recorded in st is still running.
+int state_supervisor_alive(const ContainerState *st);
+
+// Call fn for every record; stops early and returns fn's value if non-zero.
+int state_foreach(int (*fn)(const ContainerState *st, void *arg), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_STATE_H
@@ -0,0 +1,282 @@
+#include "stats.h"
+#include "cgroups.h"
+#include "memory.h"
+#include "perf.h"
+#include "state.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Cgroup-file counters for the default view.
+typedef struct CgroupSample {
+    unsigned long long usage_usec;      // cpu.stat (cpuacct.usage on v1)
+    unsigned long long nr_periods;      // cpu.stat: enforcement periods so far
+    unsigned long long nr_throttled;    // cpu.stat: periods that ran out of quota
+    unsigned long long throttled_usec;  // cpu.stat: time spent throttled
+    unsigned long long memory;          // memory.current (memory.usage_in_bytes on v1)
+    unsigned long long pids;            // pids.current
+    unsigned long long time_ns;
+} CgroupSample;
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+// Still worth sampling: the record exists and its supervisor is alive.
+static int running(const char *id) {
+    ContainerState st;
+    return state_load(id, &st) == 0 && state_supervisor_alive(&st);
+}
+
+static int read_cgroup(const char *cgroup, CgroupSample *s) {
+    memset(s, 0, sizeof(*s));
+    unsigned long long ns;
+    // v1 keeps usage in cpuacct.usage and throttled time in cpu.stat, both in ns
+    if (cgroups_read_stat(cgroup, "cpu.stat", "usage_usec", &s->usage_usec) != 0) {
+        if (cgroups_read_stat(cgroup, "cpuacct.usage", NULL, &ns) != 0) {
+            return -1;
+        }
+        s->usage_usec = ns / 1000;
+    }
+    // Only present when a quota is set (or the cpu controller is enabled)
+    cgroups_read_stat(cgroup, "cpu.stat", "nr_periods", &s->nr_periods);
+    cgroups_read_stat(cgroup, "cpu.stat", "nr_throttled", &s->nr_throttled);
+    if (cgroups_read_stat(cgroup, "cpu.stat", "throttled_usec", &s->throttled_usec) != 0 &&
+        cgroups_read_stat(cgroup, "cpu.stat", "throttled_time", &ns) == 0) {
+        s->throttled_usec = ns / 1000;
+    }
+    if (cgroups_read_stat(cgroup, "memory.current", NULL, &s->memory) != 0) {
+        cgroups_read_stat(cgroup, "memory.usage_in_bytes", NULL, &s->memory);
+    }
+    cgroups_read_stat(cgroup, "pids.current", NULL, &s->pids);
+    s->time_ns = now_ns();
+    return 0;
+}
+
+static void print_cgroup(const char *id, double t, const CgroupSample *prev,
+                         const CgroupSample *cur, int json) {
+    double wall_us = (double)(cur->time_ns - prev->time_ns) / 1000.0;
+    double cpu = wall_us > 0 ? 100.0 * (double)(cur->usage_usec - prev->usage_usec) / wall_us : 0;
+    unsigned long long periods = cur->nr_periods - prev->nr_periods;
+    unsigned long long throttled = cur->nr_throttled - prev->nr_throttled;
+    unsigned long long throttled_usec = cur->throttled_usec - prev->throttled_usec;
+    if (json) {
+        printf("{\"id\":\"%s\",\"time\":%.3f,\"cpu\":%.2f,\"memory\":%llu,\"pids\":%llu,"
+               "\"nr_periods\":%llu,\"nr_throttled\":%llu,\"throttled_usec\":%llu}\n",
+               id, t, cpu, cur->memory, cur->pids, periods, throttled, throttled_usec);
+    } else {
+        printf("%8.1f %8.1f %10.1f %6llu %10llu %8.1f\n", t, cpu,
+               (double)cur->memory / (1024.0 * 1024.0), cur->pids,
+               throttled, (double)throttled_usec / 1000.0);
+    }
+}
+
+// Format v into buf, or "-" when the inputs were not counted.
+static const char *fmt(char *buf, size_t len, int ok, const char *format, double v) {
+    if (!ok) {
+        return "-";
+    }
+    snprintf(buf, len, format, v);
+    return buf;
+}
+
+static void print_perf(const char *id, double t, const PerfSample *prev,
+                       const PerfSample *cur, int json) {
+    unsigned long long d[PERF_CTR_MAX];
+    for (int c = 0; c < PERF_CTR_MAX; c++) {
+        d[c] = cur->value[c] - prev->value[c];
+    }
+    double secs = (double)(cur->time_ns - prev->time_ns) / 1e9;
+    if (secs <= 0) {
+        secs = 1e-9;
+    }
+
+#define HAS(c) ((cur->available & (1u << (c))) != 0)
+    int have_ipc = HAS(PERF_CTR_CYCLES) && HAS(PERF_CTR_INSTRUCTIONS) && d[PERF_CTR_CYCLES] > 0;
+    int have_mpki = HAS(PERF_CTR_LLC_MISSES) && HAS(PERF_CTR_INSTRUCTIONS) &&
+                    d[PERF_CTR_INSTRUCTIONS] > 0;
+    int have_miss = HAS(PERF_CTR_LLC_MISSES) && HAS(PERF_CTR_LLC_REFERENCES) &&
+                    d[PERF_CTR_LLC_REFERENCES] > 0;
+    int have_br = HAS(PERF_CTR_BRANCH_MISSES) && HAS(PERF_CTR_INSTRUCTIONS) &&
+                  d[PERF_CTR_INSTRUCTIONS] > 0;
+    double kinstr = (double)d[PERF_CTR_INSTRUCTIONS] / 1000.0;
+    double ipc = have_ipc ? (double)d[PERF_CTR_INSTRUCTIONS] / (double)d[PERF_CTR_CYCLES] : 0;
+    double miss = have_miss ?
+        100.0 * (double)d[PERF_CTR_LLC_MISSES] / (double)d[PERF_CTR_LLC_REFERENCES] : 0;
+    double mpki = have_mpki ? (double)d[PERF_CTR_LLC_MISSES] / kinstr : 0;
+    double br = have_br ? (double)d[PERF_CTR_BRANCH_MISSES] / kinstr : 0;
+    double cpu = 100.0 * (double)d[PERF_CTR_TASK_CLOCK] / 1e9 / secs;
+
+    if (json) {
+        printf("{\"id\":\"%s\",\"time\":%.3f,\"interval\":%.3f", id, t, secs);
+        for (int c = 0; c < PERF_CTR_MAX; c++) {
+            if (HAS(c)) {
+                printf(",\"%s\":%llu", perf_counter_name((PerfCounter)c), d[c]);
+            }
+        }
+        printf(",\"cpu\":%.2f", cpu);
+        if (have_ipc) {
+            printf(",\"ipc\":%.3f", ipc);
+        }
+        if (have_miss) {
+            printf(",\"llc_miss_rate\":%.4f", miss / 100.0);
+        }
+        if (have_mpki) {
+            printf(",\"llc_mpki\":%.3f", mpki);
+        }
+        if (have_br) {
+            printf(",\"branch_mpki\":%.3f", br);
+        }
+        printf("}\n");
+        return;
+    }
+
+    char b[6][32];
+    printf("%8.1f %8.1f %6s %9s %8s %8s %10s %10s\n", t, cpu,
+           fmt(b[0], sizeof(b[0]), have_ipc, "%.2f", ipc),
+           fmt(b[1], sizeof(b[1]), have_miss, "%.1f", miss),
+           fmt(b[2], sizeof(b[2]), have_mpki, "%.2f", mpki),
+           fmt(b[3], sizeof(b[3]), have_br, "%.2f", br),
+           fmt(b[4], sizeof(b[4]), HAS(PERF_CTR_CONTEXT_SWITCHES), "%.0f",
+               (double)d[PERF_CTR_CONTEXT_SWITCHES] / secs),
+           fmt(b[5], sizeof(b[5]), HAS(PERF_CTR_PAGE_FAULTS), "%.0f",
+               (double)d[PERF_CTR_PAGE_FAULTS] / secs));
+#undef HAS
+}
+
+// Most processes sampled per container for the KSM view
+#define KSM_MAX_PIDS 4096
+
+// Sum ksm_stat over every process in the container's cgroup (or just its
+// init when the member list is unreadable). cgroup.procs lists processes on
+// v1 and v2 alike; only old v1 kernels without it fall back to tasks, which
+// lists threads, and there each thread's mm is counted again.
+static int read_ksm(const ContainerState *st, KsmStats *k, int *procs) {
+    static int pids[KSM_MAX_PIDS];
+    memset(k, 0, sizeof(*k));
+    int n = cgroups_list_pids(st->cgroup, pids, KSM_MAX_PIDS);
+    if (n <= 0) {
+        pids[0] = (int)st->pid;
+        n = 1;
+    }
+    *procs = 0;
+    for (int i = 0; i < n; i++) {
+        if (memory_read_ksm((pid_t)pids[i], k) == 0) {
+            (*procs)++;
+        }
+    }
+    return *procs > 0 ? 0 : -1;
+}
+
+static void print_ksm(const char *id, double t, const KsmStats *k, int procs, int json) {
+    unsigned long long page = (unsigned long long)sysconf(_SC_PAGESIZE);
+    if (json) {
+        printf("{\"id\":\"%s\",\"time\":%.3f,\"procs\":%d,\"merge_any\":%d,"
+               "\"merging_bytes\":%llu,\"zero_bytes\":%llu,\"profit_bytes\":%lld}\n",
+               id, t, procs, k->merge_any, k->merging_pages * page, k->zero_pages * page,
+               k->profit);
+    } else {
+        printf("%8.1f %6d %6d %12.1f %10.1f %11.1f\n", t, procs, k->merge_any,
+               (double)(k->merging_pages * page) / (1024.0 * 1024.0),
+               (double)(k->zero_pages * page) / (1024.0 * 1024.0),
+               (double)k->profit / (1024.0 * 1024.0));
+    }
+}
+
+int stats_print(const char *id, const StatsOptions *opts) {
+    if (!id || !opts || opts->interval_ms <= 0) {
+        return -1;
+    }
+    ContainerState st;
+    if (state_load(id, &st) != 0 || !state_supervisor_alive(&st)) {
+        fprintf(stderr, "No running container %s\n", id);
+        return -1;
+    }
+
+    PerfGroup *g = NULL;
+    PerfSample perf_prev;
+    CgroupSample cg_prev;
+    KsmStats ksm;
+    int procs;
+    if (opts->ksm) {
+        if (read_ksm(&st, &ksm, &procs) != 0) {
+            fprintf(stderr, "Cannot read KSM stats for %s (needs Linux 6.1+)\n", id);
+            return -1;
+        }
+        if (!memory_ksm_running()) {
+            fprintf(stderr, "ksmd is not running; nothing will be merged\n");
+        }
+    } else if (opts->perf) {
+        g = perf_open(st.cgroup);
+        if (!g || perf_read(g, &perf_prev) != 0) {
+            perf_close(g);
+            return -1;
+        }
+        if (!perf_has_hardware(g)) {
+            fprintf(stderr, "Hardware counters unavailable; reporting software events only\n");
+        }
+    } else if (read_cgroup(st.cgroup, &cg_prev) != 0) {
+        fprintf(stderr, "Cannot read cgroup stats for %s\n", id);
+        return -1;
+    }
+
+    if (!opts->json) {
+        if (opts->ksm) {
+            printf("%8s %6s %6s %12s %10s %11s\n", "TIME", "PROCS", "MERGE",
+                   "MERGING(MiB)", "ZERO(MiB)", "PROFIT(MiB)");
+        } else if (opts->perf) {
+            printf("%8s %8s %6s %9s %8s %8s %10s %10s\n", "TIME", "CPU%", "IPC",
+                   "LLC-MISS%", "LLC-MPKI", "BR-MPKI", "CTXSW/s", "FAULTS/s");
+        } else {
+            printf("%8s %8s %10s %6s %10s %8s\n", "TIME", "CPU%", "MEM(MiB)", "PIDS",
+                   "THROTTLED", "THR(ms)");
+        }
+        fflush(stdout);
+    }
+
+    unsigned long long start = now_ns();
+    int ret = 0;
+    for (int n = 0; opts->count == 0 || n < opts->count; n++) {
+        sleep_ms(opts->interval_ms);
+        if (!running(id)) {
+            break;
+        }
+        double t = (double)(now_ns() - start) / 1e9;
+
+        if (opts->ksm) {
+            if (read_ksm(&st, &ksm, &procs) != 0) {
+                break;
+            }
+            print_ksm(id, t, &ksm, procs, opts->json);
+        } else if (g) {
+            PerfSample cur;
+            if (perf_read(g, &cur) != 0) {
+                ret = -1;
+                break;
+            }
+            print_perf(id, t, &perf_prev, &cur, opts->json);
+            perf_prev = cur;
+        } else {
+            CgroupSample cur;
+            if (read_cgroup(st.cgroup, &cur) != 0) {
+                break; // Cgroup removed under us: the container is gone
+            }
+            print_cgroup(id, t, &cg_prev, &cur, opts->json);
+            cg_prev = cur;
+        }
+        fflush(stdout);
+    }
+
+    perf_close(g);
+    return ret;
+}
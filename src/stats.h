@@ -0,0 +1,26 @@
+// stats.h - Live resource and performance-counter sampling for `nsrun stats`
+
+#ifndef NSRUN_STATS_H
+#define NSRUN_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct StatsOptions {
+	int perf;         // Non-zero for perf_event counters instead of cgroup files
+	int ksm;          // Non-zero for KSM deduplication counters instead of cgroup files
+	int interval_ms;  // Time between samples
+	int count;        // Samples to print; 0 means until the container exits
+	int json;         // One JSON object per line instead of a table
+} StatsOptions;
+
+// Sample a running container and print one line per interval.
+// Returns 0 on success (including the container exiting), -1 on error.
+int stats_print(const char *id, const StatsOptions *opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_STATS_H
@@ -0,0 +1,178 @@
+#include "teardown.h"
+#include "cgroups.h"
+#include "mounts.h"
+#include "network.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Only one reaper at a time; others skip rather than queue up
+#define REAP_LOCK "/run/nsrun/reap.lock"
+
+// Run fn(arg) in a grandchild that is reparented to init, so the caller
+// neither waits for it nor has to reap it later.
+static int spawn_detached(void (*fn)(const void *arg), const void *arg) {
+    // The prewarm thread or the control poller may be inside stdio; as in
+    // step_clone, hold the stream locks so the child's fn can still print
+    flockfile(stdout);
+    flockfile(stderr);
+    pid_t pid = fork();
+    funlockfile(stderr);
+    funlockfile(stdout);
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (fork() != 0) {
+            _exit(0);
+        }
+        setsid();
+        // Don't hold the caller's terminal or pipes open while we work
+        int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+        fn(arg);
+        _exit(0);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    return 0;
+}
+
+int teardown_run(const ContainerState *st) {
+    if (!st) {
+        return -1;
+    }
+    int ret = 0;
+
+    if (st->cgroup[0] && cgroups_exists(st->cgroup)) {
+        cgroups_kill(st->cgroup);
+        if (cgroups_wait_empty(st->cgroup, TEARDOWN_TIMEOUT_MS) != 0) {
+            // Something may still be running from the image: leave it
+            // mounted and keep the record, so a later reap finishes the job
+            fprintf(stderr, "Cgroup %s did not empty in time; leaving %s for the reaper\n",
+                    st->cgroup, st->id);
+            return -1;
+        }
+        if (cgroups_destroy(st->cgroup) != 0) {
+            ret = -1;
+        }
+    }
+
+    if (st->host_if[0] && net_delete_if(st->host_if) != 0) {
+        ret = -1;
+    }
+
+    // Only after the cgroup is empty: nothing can still be using the image
+    if (st->image[0] && mounts_image_release(st->image, st->id) != 0) {
+        ret = -1;
+    }
+
+    if (state_remove(st->id) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+static void run_teardown(const void *arg) {
+    teardown_run((const ContainerState *)arg);
+}
+
+int teardown_async(const ContainerState *st) {
+    if (!st) {
+        return -1;
+    }
+    return spawn_detached(run_teardown, st);
+}
+
+struct ReapContext {
+    const char *keep_id;
+    int reaped;
+};
+
+static int reap_stale(const ContainerState *st, void *arg) {
+    struct ReapContext *ctx = arg;
+    if ((ctx->keep_id && strcmp(st->id, ctx->keep_id) == 0) ||
+        state_supervisor_alive(st)) {
+        return 0;
+    }
+    teardown_run(st);
+    ctx->reaped++;
+    return 0;
+}
+
+// Cgroups named nsrun-<pid> whose supervisor died before writing a record.
+static void reap_unrecorded_cgroups(struct ReapContext *ctx) {
+    char base[256];
+    if (cgroups_base_dir(base, sizeof(base)) != 0) {
+        return;
+    }
+    DIR *d = opendir(base);
+    if (!d) {
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        int pid;
+        char extra;
+        if (sscanf(ent->d_name, "nsrun-%d%c", &pid, &extra) != 1 ||
+            (ctx->keep_id && strcmp(ent->d_name, ctx->keep_id) == 0)) {
+            continue;
+        }
+
+        ContainerState st;
+        if (state_load(ent->d_name, &st) == 0) {
+            continue; // Has a record; reap_stale decides
+        }
+        if (kill(pid, 0) == 0 || errno != ESRCH) {
+            continue; // Supervisor (or something with its pid) still exists
+        }
+
+        memset(&st, 0, sizeof(st));
+        snprintf(st.id, sizeof(st.id), "nsrun-%d", pid);
+        snprintf(st.cgroup, sizeof(st.cgroup), "%s/%s", NSRUN_CGROUP_ROOT, st.id);
+        teardown_run(&st);
+        ctx->reaped++;
+    }
+    closedir(d);
+}
+
+int teardown_reap(const char *keep_id) {
+    int lock = open(REAP_LOCK, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    if (lock >= 0 && flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        close(lock);
+        return 0;
+    }
+
+    struct ReapContext ctx = { .keep_id = keep_id, .reaped = 0 };
+    state_foreach(reap_stale, &ctx);
+    reap_unrecorded_cgroups(&ctx);
+
+    if (lock >= 0) {
+        close(lock);
+    }
+    return ctx.reaped;
+}
+
+static void run_reap(const void *arg) {
+    teardown_reap((const char *)arg);
+}
+
+int teardown_reap_async(const char *keep_id) {
+    return spawn_detached(run_reap, keep_id);
+}
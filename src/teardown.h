@@ -0,0 +1,38 @@
+// teardown.h - Guaranteed container cleanup, inline or in the background
+
+#ifndef NSRUN_TEARDOWN_H
+#define NSRUN_TEARDOWN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "state.h"
+
+// How long to wait for a killed cgroup to drain before giving up on rmdir.
+#define TEARDOWN_TIMEOUT_MS 5000
+
+// Kill whatever is left in the container's cgroup, wait for it to empty,
+// then remove the cgroup, the host veth and the state record.
+// Returns 0 on success, -1 if any step failed (later steps still run,
+// except when the cgroup never empties: then nothing else is touched and
+// the record stays for teardown_reap).
+int teardown_run(const ContainerState *st);
+
+// teardown_run in a detached background process so the caller can return
+// (and report the exit code) immediately. Returns 0 once it is spawned.
+int teardown_async(const ContainerState *st);
+
+// Tear down containers whose supervisor is gone, e.g. after a crash, plus
+// nsrun cgroups that never got a state record. Skips the container named
+// by keep_id (may be NULL). Returns the number of containers reaped.
+int teardown_reap(const char *keep_id);
+
+// teardown_reap in a detached background process.
+int teardown_reap_async(const char *keep_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_TEARDOWN_H
@@ -0,0 +1,28 @@
+#include "util.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// mkdir -p; existing directories are not an error.
+int util_mkdir_p(const char *path, mode_t mode) {
+    char buf[PATH_MAX];
+    if (!path || snprintf(buf, sizeof(buf), "%s", path) >= (int)sizeof(buf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(buf, mode) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        *p = '/';
+    }
+    if (mkdir(buf, mode) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+// util.h - Small filesystem helpers shared by the nsrun modules
+
+#ifndef NSRUN_UTIL_H
+#define NSRUN_UTIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+// mkdir -p; existing directories are not an error. Returns 0 on success, -1 on error.
+int util_mkdir_p(const char *path, mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NSRUN_UTIL_H
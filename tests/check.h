@@ -0,0 +1,38 @@
+// check.h - Minimal assertions shared by the tests/ programs
+//
+// Each test is one program: CHECK records a failure and carries on, and
+// main ends with CHECK_DONE(). Tests that touch /run, /var/log, cgroups or
+// namespaces start with REQUIRE_ROOT(), which skips (exit 0) otherwise.
+
+#ifndef NSRUN_CHECK_H
+#define NSRUN_CHECK_H
+
+#include <stdio.h>
+#include <unistd.h>
+
+static int check_failures;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            check_failures++;                                                \
+        }                                                                    \
+    } while (0)
+
+#define REQUIRE_ROOT()                                   \
+    do {                                                 \
+        if (geteuid() != 0) {                            \
+            printf("%s: skipped (needs root)\n", __FILE__); \
+            return 0;                                    \
+        }                                                \
+    } while (0)
+
+#define CHECK_DONE()                                                         \
+    do {                                                                     \
+        printf("%s: %s\n", __FILE__, check_failures ? "FAILED" : "ok");      \
+        return check_failures ? 1 : 0;                                       \
+    } while (0)
+
+#endif // NSRUN_CHECK_H
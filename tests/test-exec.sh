@@ -0,0 +1,81 @@
+#!/bin/sh
+# test-exec.sh - nsrun exec passes the command's exit status through
+#
+# Builds a throwaway rootfs from two static helpers, starts a detached
+# container on it and runs commands in there. Needs root and a static libc;
+# run from the repository root (or set NSRUN to the binary).
+
+NSRUN=${NSRUN:-./nsrun}
+CC=${CC:-cc}
+name=tests/test-exec.sh
+
+if [ "$(id -u)" != 0 ]; then
+    echo "$name: skipped (needs root)"
+    exit 0
+fi
+
+root=$(mktemp -d /tmp/nsrun-test-exec.XXXXXX)
+id=
+failures=0
+
+cleanup() {
+    if [ -n "$id" ]; then
+        # The workload is the container's init: only SIGKILL gets through
+        pid=$(sed -n 's/^pid=//p' "/run/nsrun/containers/$id/state" 2>/dev/null)
+        [ -n "$pid" ] && kill -KILL "$pid" 2>/dev/null
+        supervisor=${id#nsrun-}
+        while kill -0 "$supervisor" 2>/dev/null; do sleep 0.1; done
+    fi
+    "$NSRUN" reap >/dev/null 2>&1
+    rm -rf "$root"
+}
+trap cleanup EXIT
+
+check() {
+    # check <expected status> <command...>
+    want=$1
+    shift
+    "$NSRUN" exec "$id" "$@" >/dev/null 2>&1
+    got=$?
+    if [ "$got" != "$want" ]; then
+        echo "$name: exec $* exited $got, want $want" >&2
+        failures=$((failures + 1))
+    fi
+}
+
+mkdir -p "$root/bin"
+# sleeper keeps the container up; code exits with argv[1], or raises it
+# as a signal with "signal" first
+printf '#include <unistd.h>\nint main(void) { sleep(60); return 0; }\n' |
+    "$CC" -static -o "$root/bin/sleeper" -x c - || exit 1
+printf '%s\n' '#include <signal.h>' '#include <stdlib.h>' '#include <string.h>' \
+    'int main(int argc, char **argv) {' \
+    '    if (argc == 3 && strcmp(argv[1], "signal") == 0) { raise(atoi(argv[2])); }' \
+    '    return argc > 1 ? atoi(argv[1]) : 0;' \
+    '}' | "$CC" -static -o "$root/bin/code" -x c - || exit 1
+
+id=$("$NSRUN" --rootfs "$root" --detach /bin/sleeper) || {
+    echo "$name: container did not start" >&2
+    exit 1
+}
+
+check 0 /bin/code 0
+check 1 /bin/code 1
+check 42 /bin/code 42
+check 255 /bin/code 255
+check 143 /bin/code signal 15   # 128 + SIGTERM
+check 137 /bin/code signal 9    # 128 + SIGKILL
+check 127 /bin/no-such-command
+check 7 -- /bin/code 7
+
+"$NSRUN" exec nsrun-0 /bin/code 0 >/dev/null 2>&1
+if [ $? != 1 ]; then
+    echo "$name: exec into a missing container did not fail with 1" >&2
+    failures=$((failures + 1))
+fi
+
+if [ "$failures" != 0 ]; then
+    echo "$name: FAILED"
+    exit 1
+fi
+echo "$name: ok"
@@ -0,0 +1,142 @@
+// test_channel.c - Control channel ring (include/nsrun_channel.h)
+//
+// Both sides in one process: the supervisor's mapping and the workload's
+// nsrun_channel_open mapping of the same memfd.
+
+#include "check.h"
+#include "nsrun_channel.h"
+#include <stdio.h>
+#include <sys/mman.h>
+
+#define CAPACITY 8
+
+// Fresh ring in a memfd; *host is the supervisor's mapping. Returns the fd.
+static int make_ring(NsrunRing **host) {
+    int fd = memfd_create("nsrun-test-channel", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)NSRUN_RING_SIZE(CAPACITY)) != 0) {
+        return -1;
+    }
+    *host = mmap(NULL, NSRUN_RING_SIZE(CAPACITY), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (*host == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    nsrun_ring_init(*host, CAPACITY);
+    return fd;
+}
+
+// Workload side: announce a copy of fd and open it like a container would.
+static int open_workload(int fd, NsrunChannel *ch) {
+    char env[16];
+    snprintf(env, sizeof(env), "%d", dup(fd));
+    setenv(NSRUN_CHANNEL_ENV, env, 1);
+    return nsrun_channel_open(ch);
+}
+
+static void test_order(void) {
+    NsrunRing *host;
+    NsrunChannel ch;
+    int fd = make_ring(&host);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    CHECK(open_workload(fd, &ch) == 0);
+    CHECK(getenv(NSRUN_CHANNEL_ENV) == NULL);
+
+    uint64_t tail = 0;
+    NsrunMessage m;
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 0);
+    CHECK(nsrun_ready(&ch) == 0);
+    CHECK(nsrun_heartbeat(&ch) == 0);
+    CHECK(nsrun_metric(&ch, "queue_depth", 12.5) == 0);
+
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1 && m.type == NSRUN_MSG_READY);
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1 && m.type == NSRUN_MSG_HEARTBEAT);
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1 && m.type == NSRUN_MSG_METRIC);
+    CHECK(strcmp(m.name, "queue_depth") == 0 && m.value == 12.5 && m.time_ns > 0);
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 0);
+    CHECK(tail == 3 && atomic_load(&host->tail) == 3);
+
+    nsrun_channel_close(&ch);
+    munmap(host, NSRUN_RING_SIZE(CAPACITY));
+    close(fd);
+}
+
+// A full ring drops (and counts) sends until the supervisor pops.
+static void test_full(void) {
+    NsrunRing *host;
+    NsrunChannel ch;
+    int fd = make_ring(&host);
+    CHECK(fd >= 0 && open_workload(fd, &ch) == 0);
+    if (fd < 0 || !ch.ring) {
+        return;
+    }
+
+    for (int i = 0; i < CAPACITY; i++) {
+        CHECK(nsrun_metric(&ch, "n", i) == 0);
+    }
+    CHECK(nsrun_metric(&ch, "n", 100) == -1);
+    CHECK(nsrun_metric(&ch, "n", 101) == -1);
+    CHECK(atomic_load(&host->dropped) == 2);
+
+    uint64_t tail = 0;
+    NsrunMessage m;
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1 && m.value == 0);
+    CHECK(nsrun_metric(&ch, "n", CAPACITY) == 0);
+    for (int i = 1; i <= CAPACITY; i++) {
+        CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1 && m.value == i);
+    }
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 0);
+
+    nsrun_channel_close(&ch);
+    munmap(host, NSRUN_RING_SIZE(CAPACITY));
+    close(fd);
+}
+
+// The workload owns the mapping and may scribble over the header; the
+// supervisor keeps its own capacity and tail and stays inside the ring.
+static void test_corrupt(void) {
+    NsrunRing *host;
+    int fd = make_ring(&host);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    uint64_t tail = 0;
+    NsrunMessage m;
+
+    host->capacity = 1u << 30;
+    memset(host->slots, 'x', CAPACITY * sizeof(NsrunMessage)); // No NUL in any name
+    atomic_store(&host->head, 1000);
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1);
+    CHECK(tail == 1000 - CAPACITY + 1);
+    CHECK(strlen(m.name) == NSRUN_CHANNEL_NAME_MAX - 1);
+
+    // A head that goes backwards reads as far ahead: still capped at capacity
+    atomic_store(&host->head, 3);
+    CHECK(nsrun_ring_pop(host, CAPACITY, &tail, &m) == 1);
+    CHECK(tail == (uint64_t)3 - CAPACITY + 1);
+
+    // And a workload will not open a ring whose header makes no sense
+    NsrunChannel ch;
+    nsrun_ring_init(host, CAPACITY);
+    host->capacity = 6;
+    CHECK(open_workload(fd, &ch) == -1);
+    host->capacity = CAPACITY * 2; // Larger than the mapping
+    CHECK(open_workload(fd, &ch) == -1);
+    nsrun_ring_init(host, CAPACITY);
+    host->magic = 0;
+    CHECK(open_workload(fd, &ch) == -1);
+    unsetenv(NSRUN_CHANNEL_ENV);
+
+    munmap(host, NSRUN_RING_SIZE(CAPACITY));
+    close(fd);
+}
+
+int main(void) {
+    test_order();
+    test_full();
+    test_corrupt();
+    CHECK_DONE();
+}
@@ -0,0 +1,117 @@
+// test_pipeline.c - Step ordering and failure propagation in the launch pipeline
+
+#include "check.h"
+#include "pipeline.h"
+#include <pthread.h>
+#include <string.h>
+
+// Steps stamp when they start and finish on one shared clock
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ticks;
+static pthread_t main_thread;
+
+typedef struct Step {
+    int result;     // What the step returns
+    int started;    // Tick at start; 0 if it never ran
+    int finished;
+    int on_main;    // Ran on the thread calling pipeline_run
+} Step;
+
+static int tick(void) {
+    pthread_mutex_lock(&clock_lock);
+    int t = ++ticks;
+    pthread_mutex_unlock(&clock_lock);
+    return t;
+}
+
+static int run_step(void *arg) {
+    Step *s = arg;
+    s->started = tick();
+    s->on_main = pthread_equal(pthread_self(), main_thread);
+    usleep(5000); // Long enough for a wrongly started dependent to show up
+    s->finished = tick();
+    return s->result;
+}
+
+// Diamond a -> {b, c} -> d, with c on the main thread.
+static void test_order(void) {
+    Step a = { 0 }, b = { 0 }, c = { 0 }, d = { 0 };
+    Pipeline *p = pipeline_create(3);
+    CHECK(p != NULL);
+    if (!p) {
+        return;
+    }
+    int ia = pipeline_add(p, "a", run_step, &a, 0);
+    int ib = pipeline_add(p, "b", run_step, &b, 0);
+    int ic = pipeline_add(p, "c", run_step, &c, PIPELINE_MAIN_THREAD);
+    int id = pipeline_add(p, "d", run_step, &d, 0);
+    CHECK(pipeline_depend(p, ib, ia) == 0);
+    CHECK(pipeline_depend(p, ic, ia) == 0);
+    CHECK(pipeline_depend(p, id, ib) == 0);
+    CHECK(pipeline_depend(p, id, ic) == 0);
+
+    CHECK(pipeline_run(p) == 0);
+    CHECK(a.started && b.started && c.started && d.started);
+    CHECK(a.finished < b.started && a.finished < c.started);
+    CHECK(b.finished < d.started && c.finished < d.started);
+    CHECK(c.on_main);
+    for (int i = ia; i <= id; i++) {
+        CHECK(pipeline_step_done(p, i));
+    }
+    pipeline_destroy(p);
+}
+
+// a fails: b (needs a) and c (needs b) are skipped, and run reports it.
+static void test_failure(void) {
+    Step a = { .result = -1 }, b = { 0 }, c = { 0 }, ok = { 0 };
+    Pipeline *p = pipeline_create(2);
+    CHECK(p != NULL);
+    if (!p) {
+        return;
+    }
+    int iok = pipeline_add(p, "ok", run_step, &ok, 0);
+    int ia = pipeline_add(p, "a", run_step, &a, 0);
+    int ib = pipeline_add(p, "b", run_step, &b, 0);
+    int ic = pipeline_add(p, "c", run_step, &c, PIPELINE_MAIN_THREAD);
+    CHECK(pipeline_depend(p, ib, ia) == 0);
+    CHECK(pipeline_depend(p, ic, ib) == 0);
+
+    CHECK(pipeline_run(p) == -1);
+    CHECK(a.started && a.finished);
+    CHECK(!b.started && !c.started);
+    CHECK(!pipeline_step_done(p, ia));
+    CHECK(!pipeline_step_done(p, ib));
+    CHECK(!pipeline_step_done(p, ic));
+    // First in line, so it started before a failed and ran to completion
+    CHECK(ok.started && pipeline_step_done(p, iok));
+    pipeline_destroy(p);
+}
+
+static void test_limits(void) {
+    Step s = { 0 };
+    Pipeline *p = pipeline_create(1);
+    CHECK(p != NULL);
+    if (!p) {
+        return;
+    }
+    int first = pipeline_add(p, "first", run_step, &s, 0);
+    CHECK(pipeline_depend(p, first, first) == -1);
+    CHECK(pipeline_depend(p, first, first + 1) == -1);
+    for (int i = 1; i < PIPELINE_MAX_STEPS; i++) {
+        CHECK(pipeline_add(p, "more", run_step, &s, 0) == i);
+    }
+    CHECK(pipeline_add(p, "full", run_step, &s, 0) == -1);
+    for (int i = 1; i <= PIPELINE_MAX_DEPS; i++) {
+        CHECK(pipeline_depend(p, first, i) == 0);
+    }
+    CHECK(pipeline_depend(p, first, PIPELINE_MAX_DEPS + 1) == -1);
+    pipeline_destroy(p);
+}
+
+int main(void) {
+    main_thread = pthread_self();
+    test_order();
+    test_failure();
+    test_limits();
+    CHECK_DONE();
+}
@@ -0,0 +1,58 @@
+// test_volume.c - --volume spec parsing (mounts_parse_volume)
+
+#include "check.h"
+#include "mounts.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Parse spec and compare against the expected result.
+static void expect(const char *spec, const char *source, const char *target, int read_only) {
+    MountVolume *vol = mounts_parse_volume(spec);
+    CHECK(vol != NULL);
+    if (!vol) {
+        fprintf(stderr, "  spec: %s\n", spec);
+        return;
+    }
+    CHECK(strcmp(vol->source, source) == 0);
+    CHECK(strcmp(vol->target, target) == 0);
+    CHECK(vol->read_only == read_only);
+    CHECK(vol->next == NULL);
+    mounts_free_volumes(vol);
+}
+
+static void expect_invalid(const char *spec) {
+    MountVolume *vol = mounts_parse_volume(spec);
+    CHECK(vol == NULL);
+    if (vol) {
+        fprintf(stderr, "  accepted: %s\n", spec);
+        mounts_free_volumes(vol);
+    }
+}
+
+int main(void) {
+    char tmp[PATH_MAX];
+    char cwd[PATH_MAX];
+    CHECK(realpath("/tmp", tmp) != NULL);
+    CHECK(getcwd(cwd, sizeof(cwd)) != NULL);
+
+    expect("/tmp:/data", tmp, "/data", 0);
+    expect("/tmp:/data:rw", tmp, "/data", 0);
+    expect("/tmp:/data:ro", tmp, "/data", 1);
+    expect("/tmp/:/a/b/c:ro", tmp, "/a/b/c", 1);
+    // Sources are resolved on the host
+    expect(".:/src", cwd, "/src", 0);
+
+    expect_invalid(NULL);
+    expect_invalid("");
+    expect_invalid("/tmp");               // No target
+    expect_invalid(":/data");             // Empty source
+    expect_invalid("/tmp:");              // Empty target
+    expect_invalid("/tmp:data");          // Relative target
+    expect_invalid("/tmp:/a/../etc");     // Climbs out of the target
+    expect_invalid("/tmp:/data:rx");      // Unknown option
+    expect_invalid("/tmp:/data:ro:x");    // Trailing junk
+    expect_invalid("/nsrun-no-such-dir:/data");
+
+    CHECK_DONE();
+}